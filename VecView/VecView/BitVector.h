@@ -0,0 +1,207 @@
+//
+// Bit vectors for binary embeddings and hashes. Bit i is bit i % 64 of 64 bit word i / 64, unused bits of the last word are 0.
+// Vec(bits) is an ordinary view with coordinates 0 and 1, and for pairs of bit views
+// Dot is popcount(a AND b), Hamming is popcount(a XOR b) and Jaccard is popcount(a AND b) / popcount(a OR b).
+// Popcounts of long vectors use Harley-Seal carry-save adders, so only one popcount instruction is done per 16 words,
+// and vectors of millions of words are split between threads.
+//
+// Use example:
+//
+// BitVector a(embedding, dim), b(dim);         // a has bits of positive coordinates, b is all zero
+// b.Set(5, true);
+// int common = Dot(Vec(a), Vec(b));
+// int dist = Hamming(Vec(a), Vec(b));
+// double sim = Jaccard(Vec(a), Vec(b));
+//
+
+#pragma once
+
+#include "VecView.h"
+#include <cstdint>
+#include <vector>
+
+// MSVC emits popcnt for the intrinsic unconditionally, so it is used only when AVX (which implies popcnt) is enabled
+#if defined(_MSC_VER) && defined(_M_X64) && defined(__AVX__)
+#include <intrin.h>
+#define VEVI_POPCNT64
+#endif
+
+namespace vevi
+{
+	class BitVector;
+
+	namespace details
+	{
+		inline int PopCount(std::uint64_t x)
+		{
+#if defined(VEVI_POPCNT64)
+			return int(__popcnt64(x));
+#elif defined(__GNUC__)
+			return __builtin_popcountll(x);
+#else
+			x = x - ((x >> 1) & 0x5555555555555555ull);
+			x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+			x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+			return int((x * 0x0101010101010101ull) >> 56);
+#endif
+		}
+
+		// Carry-save adder: h:l = a + b + c bit by bit
+		inline void Csa(std::uint64_t & h, std::uint64_t & l, std::uint64_t a, std::uint64_t b, std::uint64_t c)
+		{
+			const std::uint64_t u = a ^ b;
+			h = (a & b) | (u & c);
+			l = u ^ c;
+		}
+
+		// Sum of popcounts of op(a[i], b[i]) for n words. Harley-Seal: words are added 16 at a time into bit-sliced
+		// counters ones, twos, fours, eights and only sixteens are popcounted.
+		template<typename Op>
+		inline long long PopCountWords(const std::uint64_t * a, const std::uint64_t * b, int n, const Op & op)
+		{
+			long long total = 0;
+			std::uint64_t ones = 0, twos = 0, fours = 0, eights = 0, sixteens;
+			std::uint64_t twosA, twosB, foursA, foursB, eightsA, eightsB;
+			int i = 0;
+			for (; i + 16 <= n; i += 16)
+			{
+				Csa(twosA, ones, ones, op(a[i], b[i]), op(a[i + 1], b[i + 1]));
+				Csa(twosB, ones, ones, op(a[i + 2], b[i + 2]), op(a[i + 3], b[i + 3]));
+				Csa(foursA, twos, twos, twosA, twosB);
+				Csa(twosA, ones, ones, op(a[i + 4], b[i + 4]), op(a[i + 5], b[i + 5]));
+				Csa(twosB, ones, ones, op(a[i + 6], b[i + 6]), op(a[i + 7], b[i + 7]));
+				Csa(foursB, twos, twos, twosA, twosB);
+				Csa(eightsA, fours, fours, foursA, foursB);
+				Csa(twosA, ones, ones, op(a[i + 8], b[i + 8]), op(a[i + 9], b[i + 9]));
+				Csa(twosB, ones, ones, op(a[i + 10], b[i + 10]), op(a[i + 11], b[i + 11]));
+				Csa(foursA, twos, twos, twosA, twosB);
+				Csa(twosA, ones, ones, op(a[i + 12], b[i + 12]), op(a[i + 13], b[i + 13]));
+				Csa(twosB, ones, ones, op(a[i + 14], b[i + 14]), op(a[i + 15], b[i + 15]));
+				Csa(foursB, twos, twos, twosA, twosB);
+				Csa(eightsB, fours, fours, foursA, foursB);
+				Csa(sixteens, eights, eights, eightsA, eightsB);
+				total += PopCount(sixteens);
+			}
+			total = 16 * total + 8 * PopCount(eights) + 4 * PopCount(fours) + 2 * PopCount(twos) + PopCount(ones);
+			for (; i < n; ++i)
+				total += PopCount(op(a[i], b[i]));
+			return total;
+		}
+
+		// Splits long vectors between threads
+		template<typename Op>
+		inline long long PopCountParallel(const std::uint64_t * a, const std::uint64_t * b, int n, const Op & op)
+		{
+			const int grain = 1 << 16;
+			std::vector<long long> partial(ParallelThreads(n, grain), 0);
+			ParallelFor(n, grain, [&](int begin, int end, int t)
+			{
+				partial[t] += PopCountWords(a + begin, b + begin, end - begin, op);
+			});
+			long long total = 0;
+			for (long long p : partial) total += p;
+			return total;
+		}
+
+		struct AndOp { std::uint64_t operator()(std::uint64_t a, std::uint64_t b) const { return a & b; } };
+		struct OrOp { std::uint64_t operator()(std::uint64_t a, std::uint64_t b) const { return a | b; } };
+		struct XorOp { std::uint64_t operator()(std::uint64_t a, std::uint64_t b) const { return a ^ b; } };
+
+		namespace storages
+		{
+			// Storage interface over bits of BitVector, coordinates are 0 and 1. Read only.
+			struct BitArrayPtr
+			{
+				using ElementType = int;
+				int operator[](int idx) const
+				{
+					return int((words[idx >> 6] >> (idx & 63)) & 1);
+				}
+				BitArrayPtr(const std::uint64_t * words) : words(words) {}
+				const std::uint64_t * Data() const { return words; }
+			private:
+				const std::uint64_t * words;
+			};
+		}
+
+		inline int BitWords(int bits) { return (bits + 63) / 64; }
+	}
+
+	class BitVector
+	{
+		int bits;
+		std::vector<std::uint64_t> words;
+
+	public:
+		explicit BitVector(int bits = 0) : bits(bits), words(details::BitWords(bits), 0) {}
+
+		// Bits of positive coordinates of data, i.e. sign hash of an embedding
+		template<typename T>
+		BitVector(const T * data, int n) : bits(n), words(details::BitWords(n), 0)
+		{
+			for (int i = 0; i < n; ++i)
+				if (data[i] > T(0))
+					words[i >> 6] |= std::uint64_t(1) << (i & 63);
+		}
+
+		int Size() const { return bits; }
+		bool Get(int i) const { return ((words[i >> 6] >> (i & 63)) & 1) != 0; }
+		void Set(int i, bool value)
+		{
+			const std::uint64_t bit = std::uint64_t(1) << (i & 63);
+			words[i >> 6] = value ? words[i >> 6] | bit : words[i >> 6] & ~bit;
+		}
+		int Count() const
+		{
+			return int(details::PopCountParallel(words.data(), words.data(), int(words.size()), details::AndOp()));
+		}
+		const std::uint64_t * Data() const { return words.data(); }
+		std::uint64_t * Data() { return words.data(); }
+	};
+
+	inline details::VectorView<details::storages::BitArrayPtr> Vec(const BitVector & bits)
+	{
+		return{ { bits.Data() }, bits.Size() };
+	}
+
+	// Number of common bits
+	inline details::NumberView<int> Dot(const details::VectorView<details::storages::BitArrayPtr> & a,
+		const details::VectorView<details::storages::BitArrayPtr> & b)
+	{
+		return int(details::PopCountParallel(a.GetStorage().Data(), b.GetStorage().Data(), details::BitWords(a.Dim()), details::AndOp()));
+	}
+
+	// Number of different bits
+	inline int Hamming(const details::VectorView<details::storages::BitArrayPtr> & a,
+		const details::VectorView<details::storages::BitArrayPtr> & b)
+	{
+		return int(details::PopCountParallel(a.GetStorage().Data(), b.GetStorage().Data(), details::BitWords(a.Dim()), details::XorOp()));
+	}
+
+	// Size of intersection over size of union, 1 for two empty sets
+	inline double Jaccard(const details::VectorView<details::storages::BitArrayPtr> & a,
+		const details::VectorView<details::storages::BitArrayPtr> & b)
+	{
+		// Both counts are taken chunk by chunk, so every word is read from memory once
+		const std::uint64_t * pa = a.GetStorage().Data(), * pb = b.GetStorage().Data();
+		const int n = details::BitWords(a.Dim()), grain = 1 << 16, chunk = 1024;
+		const int threads = details::ParallelThreads(n, grain);
+		std::vector<long long> both(threads, 0), any(threads, 0);
+		details::ParallelFor(n, grain, [&](int begin, int end, int t)
+		{
+			for (int c = begin; c < end; c += chunk)
+			{
+				const int size = end - c < chunk ? end - c : chunk;
+				both[t] += details::PopCountWords(pa + c, pb + c, size, details::AndOp());
+				any[t] += details::PopCountWords(pa + c, pb + c, size, details::OrOp());
+			}
+		});
+		long long inter = 0, uni = 0;
+		for (int t = 0; t < threads; ++t)
+		{
+			inter += both[t];
+			uni += any[t];
+		}
+		return uni ? double(inter) / double(uni) : 1.0;
+	}
+}
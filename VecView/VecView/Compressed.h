@@ -0,0 +1,446 @@
+//
+// Compressed storages for vectors of small integers (ids, counts, sorted offsets).
+// Values are split in blocks of 128. Every block is packed with its own bit width after subtracting the block minimum
+// (frame of reference), or, for delta encoding, after taking differences of values 4 positions apart, which makes sorted
+// vectors tiny. Bits of a block are laid out in 4 interleaved lanes so that 4 values are unpacked at once with SSE2 shifts,
+// and differences of delta encoding are added up within every lane, one addition per 4 values.
+//
+// Views of compressed vectors are stateless and may be shared between threads. Single coordinates are extracted
+// directly from packed bits (delta encoded ones decode their block). Assignments and Dot
+// decode whole blocks of compressed leaves into buffers of the evaluation (see DecodeBlock in VecView.h),
+// so they read every value once from a buffer in L1.
+//
+// Run-length encoded vectors keep runs of equal values (value and end of run). Sum and Dot process whole runs:
+// zero runs are skipped and other operand of Dot is only summed over a run before multiplication by its value.
+//
+// Use example:
+//
+// PackedVector<int> packed(ids, n);            // or PackedVector<int>(offsets, n, true) for delta encoding
+// int total = Sum(Vec(packed));                // decodes blocks straight into accumulators
+// AVec(out, n) = Vec(packed) + Vec(dense);
+//
+// RleVector<float> mask(values, n);            // or RleVector<float> mask; mask.Append(0.f, 1000000); mask.Append(1.f, 10);
+// float masked = Dot(Vec(mask), Vec(dense));   // reads dense only where mask is not zero
+//
+
+#pragma once
+
+#include "VecView.h"
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+namespace vevi
+{
+	template<typename T>
+	class PackedVector;
+	template<typename T>
+	class RleVector;
+
+	namespace details
+	{
+		const int PackedBlock = 128;
+
+		inline int BitWidth(std::uint32_t x)
+		{
+			int b = 0;
+			while (x)
+			{
+				++b;
+				x >>= 1;
+			}
+			return b;
+		}
+
+		// Value j of lane k (j < 32, k < 4) is at bits [j * width, (j + 1) * width) of the lane, lane words are interleaved.
+		inline void PackBlock(const std::uint32_t * in, int width, std::uint32_t * words)
+		{
+			for (int w = 0; w < 4 * width; ++w) words[w] = 0;
+			if (width == 0)
+				return;
+			for (int i = 0; i < PackedBlock; ++i)
+			{
+				const int lane = i & 3, bit = (i >> 2) * width;
+				const int w = bit >> 5, sh = bit & 31;
+				words[4 * w + lane] |= in[i] << sh;
+				if (sh + width > 32)
+					words[4 * (w + 1) + lane] |= in[i] >> (32 - sh);
+			}
+		}
+
+#ifdef VEVI_SSE2
+		// Unpacks 4 values of every lane per step. Width is a template argument, so shifts are immediates and
+		// the steps are unrolled at compile time. Delta encoded values are added up in the same step: every lane
+		// keeps a running sum of its differences in carry.
+		template<int Width, bool Delta, int J>
+		struct UnpackLanes
+		{
+			static void run(const __m128i * in, __m128i mask, __m128i base, __m128i carry, __m128i * out)
+			{
+				const int bit = J * Width, w = bit >> 5, sh = bit & 31;
+				// blocks of width 0 have no words
+				__m128i v = base;
+				if (Width)
+				{
+					__m128i x = _mm_srli_epi32(_mm_loadu_si128(in + w), sh);
+					if (sh + Width > 32)
+						x = _mm_or_si128(x, _mm_slli_epi32(_mm_loadu_si128(in + w + 1), (32 - sh) & 31));
+					// the top field of a word has no higher bits to clear
+					v = _mm_add_epi32(sh + Width == 32 ? x : _mm_and_si128(x, mask), base);
+				}
+				if (Delta)
+					v = carry = _mm_add_epi32(carry, v);
+				_mm_storeu_si128(out + J, v);
+				UnpackLanes<Width, Delta, J + 1>::run(in, mask, base, carry, out);
+			}
+		};
+		template<int Width, bool Delta>
+		struct UnpackLanes<Width, Delta, PackedBlock / 4>
+		{
+			static void run(const __m128i *, __m128i, __m128i, __m128i, __m128i *) {}
+		};
+
+		template<int Width, bool Delta>
+		inline void UnpackWidth(const std::uint32_t * words, std::uint32_t base, const std::uint32_t * prev, std::uint32_t * out)
+		{
+			const __m128i mask = _mm_set1_epi32(int(Width == 32 ? ~0u : (1u << (Width & 31)) - 1));
+			UnpackLanes<Width, Delta, 0>::run(reinterpret_cast<const __m128i*>(words), mask, _mm_set1_epi32(int(base)),
+				Delta ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(prev)) : _mm_setzero_si128(), reinterpret_cast<__m128i*>(out));
+		}
+#endif
+
+		// Writes base plus every packed value of block to out, for delta encoding value i is that plus value i - 4
+		// (prev[i] for the first 4 values, the 4 values before block)
+		inline void UnpackBlock(const std::uint32_t * words, int width, std::uint32_t base, bool delta, const std::uint32_t * prev,
+			std::uint32_t * out)
+		{
+#ifdef VEVI_SSE2
+			typedef void(*Unpack)(const std::uint32_t *, std::uint32_t, const std::uint32_t *, std::uint32_t *);
+#define VEVI_UNPACK_WIDTHS(D) \
+			UnpackWidth<0, D>, UnpackWidth<1, D>, UnpackWidth<2, D>, UnpackWidth<3, D>, UnpackWidth<4, D>, UnpackWidth<5, D>, \
+			UnpackWidth<6, D>, UnpackWidth<7, D>, UnpackWidth<8, D>, UnpackWidth<9, D>, UnpackWidth<10, D>, UnpackWidth<11, D>, \
+			UnpackWidth<12, D>, UnpackWidth<13, D>, UnpackWidth<14, D>, UnpackWidth<15, D>, UnpackWidth<16, D>, UnpackWidth<17, D>, \
+			UnpackWidth<18, D>, UnpackWidth<19, D>, UnpackWidth<20, D>, UnpackWidth<21, D>, UnpackWidth<22, D>, UnpackWidth<23, D>, \
+			UnpackWidth<24, D>, UnpackWidth<25, D>, UnpackWidth<26, D>, UnpackWidth<27, D>, UnpackWidth<28, D>, UnpackWidth<29, D>, \
+			UnpackWidth<30, D>, UnpackWidth<31, D>, UnpackWidth<32, D>
+			static const Unpack unpack[2][33] = { { VEVI_UNPACK_WIDTHS(false) }, { VEVI_UNPACK_WIDTHS(true) } };
+#undef VEVI_UNPACK_WIDTHS
+			unpack[delta][width](words, base, prev, out);
+#else
+			const std::uint32_t mask = width == 32 ? ~0u : (1u << width) - 1;
+			for (int i = 0; i < PackedBlock; ++i)
+			{
+				std::uint32_t v = 0;
+				if (width)
+				{
+					const int lane = i & 3, bit = (i >> 2) * width;
+					const int w = bit >> 5, sh = bit & 31;
+					v = words[4 * w + lane] >> sh;
+					if (sh + width > 32)
+						v |= words[4 * (w + 1) + lane] << (32 - sh);
+				}
+				out[i] = (v & mask) + base;
+				if (delta)
+					out[i] += i < 4 ? prev[i] : out[i - 4];
+			}
+#endif
+		}
+
+		namespace storages
+		{
+			// Storage interface over PackedVector. Read only.
+			template<typename T>
+			struct PackedArrayPtr
+			{
+				using ElementType = T;
+				T operator[](int idx) const { return packed->Get(idx); }
+				void Decode(int begin, int count, T * out) const
+				{
+					if (count == PackedBlock)
+						packed->Decode(begin / PackedBlock, out);
+					else
+					{
+						T buf[PackedBlock];
+						packed->Decode(begin / PackedBlock, buf);
+						std::copy(buf, buf + count, out);
+					}
+				}
+				PackedArrayPtr(const PackedVector<T> & packed) : packed(&packed) {}
+				const PackedVector<T> & Vector() const { return *packed; }
+			private:
+				const PackedVector<T> * packed;
+			};
+
+			// Storage interface over RleVector. Read only, single coordinates find their run by binary search.
+			template<typename T>
+			struct RleArrayPtr
+			{
+				using ElementType = T;
+				T operator[](int idx) const
+				{
+					const int * ends = rle->Ends();
+					return rle->Values()[std::upper_bound(ends, ends + rle->Runs(), idx) - ends];
+				}
+				void Decode(int begin, int count, T * out) const
+				{
+					const int * ends = rle->Ends();
+					int run = int(std::upper_bound(ends, ends + rle->Runs(), begin) - ends);
+					for (int i = 0; i < count; ++run)
+					{
+						const int end = ends[run] - begin < count ? ends[run] - begin : count;
+						for (; i < end; ++i) out[i] = rle->Values()[run];
+					}
+				}
+				RleArrayPtr(const RleVector<T> & rle) : rle(&rle) {}
+				const RleVector<T> & Vector() const { return *rle; }
+			private:
+				const RleVector<T> * rle;
+			};
+		}
+	}
+
+	// Vector of integers (up to 32 bit) compressed block by block, see above
+	template<typename T>
+	class PackedVector
+	{
+		static_assert(std::is_integral<T>::value && sizeof(T) <= 4, "PackedVector keeps integers up to 32 bit");
+
+		struct Block
+		{
+			std::uint32_t base; // minimum of block (of differences for delta encoding)
+			int width;
+			int offset; // first word, for delta encoding the 4 values before block are the words before it
+		};
+
+		int n;
+		bool delta;
+		std::vector<Block> blocks;
+		std::vector<std::uint32_t> words;
+
+		// Packed value j of block, see PackBlock
+		std::uint32_t Raw(const Block & block, int j) const
+		{
+			if (block.width == 0)
+				return 0;
+			const std::uint32_t * w = words.data() + block.offset;
+			const int lane = j & 3, bit = (j >> 2) * block.width;
+			const int word = bit >> 5, sh = bit & 31;
+			std::uint32_t v = w[4 * word + lane] >> sh;
+			if (sh + block.width > 32)
+				v |= w[4 * (word + 1) + lane] << (32 - sh);
+			return block.width == 32 ? v : v & ((1u << block.width) - 1);
+		}
+
+	public:
+		// Encodes n values. Delta encoding suits sorted or slowly changing vectors.
+		PackedVector(const T * data, int n, bool delta = false) : n(n), delta(delta)
+		{
+			const int count = (n + details::PackedBlock - 1) / details::PackedBlock;
+			blocks.resize(count);
+			std::uint32_t in[details::PackedBlock];
+			for (int b = 0; b < count; ++b)
+			{
+				const int begin = b * details::PackedBlock;
+				const int size = n - begin < details::PackedBlock ? n - begin : details::PackedBlock;
+				long long lo = 0, hi = 0;
+				for (int i = 0; i < size; ++i)
+				{
+					const long long v = delta ? (long long)data[begin + i] - (begin + i >= 4 ? (long long)data[begin + i - 4] : 0) : (long long)data[begin + i];
+					in[i] = std::uint32_t(v);
+					lo = i == 0 || v < lo ? v : lo;
+					hi = i == 0 || v > hi ? v : hi;
+				}
+				// Arithmetic is modulo 2^32, so differences that span more than 32 bits are still restored exactly
+				Block & block = blocks[b];
+				block.base = hi - lo <= 0xFFFFFFFFll ? std::uint32_t(lo) : 0;
+				std::uint32_t top = 0;
+				for (int i = 0; i < size; ++i)
+				{
+					in[i] -= block.base;
+					top = in[i] > top ? in[i] : top;
+				}
+				for (int i = size; i < details::PackedBlock; ++i) in[i] = 0;
+				block.width = details::BitWidth(top);
+				if (delta)
+					for (int k = begin - 4; k < begin; ++k)
+						words.push_back(k >= 0 ? std::uint32_t(data[k]) : 0);
+				block.offset = int(words.size());
+				words.resize(words.size() + 4 * block.width);
+				details::PackBlock(in, block.width, words.data() + block.offset);
+			}
+		}
+
+		int Size() const { return n; }
+		int Blocks() const { return int(blocks.size()); }
+		// Memory taken by encoded values
+		size_t Bytes() const { return words.size() * sizeof(std::uint32_t) + blocks.size() * sizeof(Block); }
+
+		// Value i, for delta encoding its block is decoded
+		T Get(int i) const
+		{
+			const Block & block = blocks[i / details::PackedBlock];
+			const int j = i % details::PackedBlock;
+			if (!delta)
+				return T(Raw(block, j) + block.base);
+			T buf[details::PackedBlock];
+			Decode(i / details::PackedBlock, buf);
+			return buf[j];
+		}
+
+		// Writes values of block b to out (PackedBlock values, tail of the last block is padding)
+		void Decode(int b, T * out) const
+		{
+			const Block & block = blocks[b];
+			// 32 bit values are unpacked in place, narrower ones through a buffer
+			std::uint32_t buf[details::PackedBlock];
+			std::uint32_t * raw = sizeof(T) == 4 ? reinterpret_cast<std::uint32_t*>(out) : buf;
+			const std::uint32_t * w = words.data() + block.offset;
+			details::UnpackBlock(w, block.width, block.base, delta, delta ? w - 4 : nullptr, raw);
+			if (sizeof(T) != 4)
+				for (int i = 0; i < details::PackedBlock; ++i)
+					out[i] = T(raw[i]);
+		}
+	};
+
+	template<typename T>
+	inline details::VectorView<details::storages::PackedArrayPtr<T>> Vec(const PackedVector<T> & packed)
+	{
+		return{ { packed }, packed.Size() };
+	}
+
+	// Sum of packed vector, blocks are decoded into a buffer in L1 and added to partial sums of every position
+	// of a block, a loop of constant length over buffers that compilers vectorize
+	template<typename T>
+	inline details::NumberView<T> Sum(const details::VectorView<details::storages::PackedArrayPtr<T>> & v)
+	{
+		const PackedVector<T> & packed = v.GetStorage().Vector();
+		T buf[details::PackedBlock], sum[details::PackedBlock] = {};
+		for (int b = 0; b * details::PackedBlock < v.Dim(); ++b)
+		{
+			packed.Decode(b, buf);
+			const int size = v.Dim() - b * details::PackedBlock;
+			if (size >= details::PackedBlock)
+				for (int i = 0; i < details::PackedBlock; ++i)
+					sum[i] += buf[i];
+			else
+				for (int i = 0; i < size; ++i)
+					sum[i] += buf[i];
+		}
+		return details::ReduceRange(Plus(), T(0), 0, details::PackedBlock, [&](int i) { return sum[i]; });
+	}
+
+	// Vector of runs of equal values
+	template<typename T>
+	class RleVector
+	{
+		std::vector<T> values;
+		std::vector<int> ends; // exclusive ends of runs, the last one is Size()
+
+	public:
+		RleVector() {}
+		RleVector(const T * data, int n)
+		{
+			for (int i = 0; i < n; ++i)
+				Append(data[i], 1);
+		}
+
+		// Adds count copies of value to the end, joining it with the last run if it has the same value
+		void Append(const T & value, int count)
+		{
+			if (count <= 0)
+				return;
+			if (!values.empty() && values.back() == value)
+				ends.back() += count;
+			else
+			{
+				values.push_back(value);
+				ends.push_back(Size() + count);
+			}
+		}
+
+		int Size() const { return ends.empty() ? 0 : ends.back(); }
+		int Runs() const { return int(values.size()); }
+		const T * Values() const { return values.data(); }
+		const int * Ends() const { return ends.data(); }
+		int Begin(int run) const { return run ? ends[run - 1] : 0; }
+	};
+
+	template<typename T>
+	inline details::VectorView<details::storages::RleArrayPtr<T>> Vec(const RleVector<T> & rle)
+	{
+		return{ { rle }, rle.Size() };
+	}
+
+	// Sum of run-length encoded vector, every run is one multiplication
+	template<typename T>
+	inline details::NumberView<T> Sum(const details::VectorView<details::storages::RleArrayPtr<T>> & v)
+	{
+		const RleVector<T> & rle = v.GetStorage().Vector();
+		T res = T(0);
+		for (int r = 0; r < rle.Runs() && rle.Begin(r) < v.Dim(); ++r)
+		{
+			const int end = rle.Ends()[r] < v.Dim() ? rle.Ends()[r] : v.Dim();
+			res += rle.Values()[r] * T(end - rle.Begin(r));
+		}
+		return res;
+	}
+
+	namespace details
+	{
+		// Dot of run-length encoded vector with any expression: zero runs are skipped, other runs multiply
+		// the run value by the sum of the expression over the run
+		template<typename T, typename Arg>
+		inline decltype(T() * std::declval<typename Arg::type>()) RleDot(const RleVector<T> & rle, int dim, const Arg & v)
+		{
+			using type = decltype(T() * std::declval<typename Arg::type>());
+			type res = type(0);
+			for (int r = 0; r < rle.Runs() && rle.Begin(r) < dim; ++r)
+			{
+				if (rle.Values()[r] == T(0))
+					continue;
+				const int end = rle.Ends()[r] < dim ? rle.Ends()[r] : dim;
+				typename Arg::type s = typename Arg::type(0);
+				for (int i = rle.Begin(r); i < end; ++i)
+					s += v.Evaluate(i);
+				res += rle.Values()[r] * s;
+			}
+			return res;
+		}
+	}
+
+	template<typename T, typename Arg2>
+	inline details::NumberView<decltype(T() * std::declval<typename Arg2::type>())>
+		Dot(const details::VectorView<details::storages::RleArrayPtr<T>> & v1, const Arg2 & v2)
+	{
+		return details::RleDot(v1.GetStorage().Vector(), v1.Dim(), v2);
+	}
+
+	template<typename Arg1, typename T>
+	inline details::NumberView<decltype(std::declval<typename Arg1::type>() * T())>
+		Dot(const Arg1 & v1, const details::VectorView<details::storages::RleArrayPtr<T>> & v2)
+	{
+		return details::RleDot(v2.GetStorage().Vector(), v2.Dim(), v1);
+	}
+
+	// Both vectors are run-length encoded: runs are merged, so the cost is proportional to number of runs
+	template<typename T1, typename T2>
+	inline details::NumberView<decltype(T1() * T2())> Dot(const details::VectorView<details::storages::RleArrayPtr<T1>> & v1,
+		const details::VectorView<details::storages::RleArrayPtr<T2>> & v2)
+	{
+		using type = decltype(T1() * T2());
+		const RleVector<T1> & a = v1.GetStorage().Vector();
+		const RleVector<T2> & b = v2.GetStorage().Vector();
+		const int dim = v1.Dim();
+		type res = type(0);
+		int i = 0;
+		for (int ra = 0, rb = 0; i < dim && ra < a.Runs() && rb < b.Runs();)
+		{
+			const int end = std::min(std::min(a.Ends()[ra], b.Ends()[rb]), dim);
+			res += a.Values()[ra] * b.Values()[rb] * type(end - i);
+			i = end;
+			if (a.Ends()[ra] == end) ++ra;
+			if (b.Ends()[rb] == end) ++rb;
+		}
+		return res;
+	}
+}
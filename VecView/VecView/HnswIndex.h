@@ -0,0 +1,460 @@
+//
+// HNSW (hierarchical navigable small world) graph index for low latency nearest neighbour search.
+// Vectors are kept in one contiguous store and distances are evaluated by Dot on Vec views into it.
+// Neighbours' vectors are prefetched before their distances are computed.
+//
+// Insert may be called from several threads at once and concurrently with Search: every link list is guarded by its own
+// mutex which is held only while the list is copied or changed, so no thread ever holds two of them.
+// Entry point and top level are published together in one atomic word, so Search reads them without locking.
+//
+// Save writes the index to a flat file with 64 byte aligned sections. Load reads it back with a single read, and
+// Attach uses an image mapped to memory by the caller (e.g. with mmap / MapViewOfFile) without copying.
+// Loaded and attached indices are read only.
+//
+// Use example:
+//
+// HnswIndex<float> index(dim, capacity);
+// for (int i = 0; i < n; ++i) index.Insert(base + i * dim);
+// index.Search(query, 10, 64, ids, dists);
+// index.Save("index.hnsw");
+//
+
+#pragma once
+
+#include "VecView.h"
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <functional>
+#include <algorithm>
+#include <utility>
+#include <limits>
+
+namespace vevi
+{
+	template<typename T>
+	class HnswIndex
+	{
+		using Candidate = std::pair<float, int>;
+
+		struct Header
+		{
+			char magic[8];
+			int elementSize, dim, M, M0, count, maxLevel, entry, metric;
+			long long vectors, levels, links0, upperOffsets, upper, size;
+		};
+
+		// Marks of visited nodes, reset in O(1) by changing tag
+		struct VisitedList
+		{
+			std::vector<unsigned> marks;
+			unsigned tag;
+			VisitedList(int n) : marks(n, 0), tag(0) {}
+			void Reset()
+			{
+				if (++tag == 0)
+				{
+					std::fill(marks.begin(), marks.end(), 0);
+					tag = 1;
+				}
+			}
+		};
+
+		int dim = 0, M = 0, M0 = 0, efConstruction = 0, capacity = 0;
+		Metric metric = Metric::SquaredL2;
+		unsigned seed = 0;
+		std::atomic<int> count;
+		// Entry point in low and top level in high 32 bits, -1 in both while empty
+		std::atomic<std::uint64_t> top;
+
+		// Storage of index being built
+		std::vector<T> vectorStore;
+		std::vector<int> levelStore;
+		std::vector<int> links0Store;
+		std::vector<std::vector<int>> upperStore;
+		std::unique_ptr<std::mutex[]> locks;
+		// Serializes inserters that may change the entry point, never taken by Search
+		std::mutex entryLock;
+
+		// Storage of loaded or attached index
+		std::vector<long long> imageBuffer;
+		const long long * upperOffsets = nullptr;
+		const int * upperFlat = nullptr;
+		bool readOnly = false;
+
+		const T * vectors = nullptr;
+		const int * levels = nullptr;
+		const int * links0 = nullptr;
+
+		std::mutex poolLock;
+		std::vector<std::unique_ptr<VisitedList>> pool;
+
+		const T * Vector(int id) const { return vectors + size_t(id) * dim; }
+
+		static std::uint64_t Pack(int entry, int level) { return (std::uint64_t(std::uint32_t(level)) << 32) | std::uint32_t(entry); }
+		void Top(int & entry, int & level) const
+		{
+			const std::uint64_t t = top.load(std::memory_order_acquire);
+			entry = int(std::uint32_t(t));
+			level = int(std::uint32_t(t >> 32));
+		}
+
+		// Link list of node at level: count of links followed by links
+		const int * Links(int id, int level) const
+		{
+			if (level == 0) return links0 + size_t(id) * (M0 + 1);
+			if (readOnly) return upperFlat + upperOffsets[id] + (level - 1) * (M + 1);
+			return upperStore[id].data() + (level - 1) * (M + 1);
+		}
+		int * MutableLinks(int id, int level)
+		{
+			return const_cast<int*>(Links(id, level));
+		}
+
+		float Distance(const T * a, const T * b) const
+		{
+			if (metric == Metric::Cosine)
+				return 1 - float(Dot(Vec(a, dim), Vec(b)));
+			return float(Dot(Vec(a, dim) - Vec(b), Vec(a) - Vec(b)));
+		}
+
+		// Copies link list so that it can be used without holding the lock
+		void ReadLinks(int id, int level, std::vector<int> & out) const
+		{
+			std::unique_lock<std::mutex> lock;
+			if (!readOnly) lock = std::unique_lock<std::mutex>(locks[id]);
+			const int * l = Links(id, level);
+			out.assign(l + 1, l + 1 + l[0]);
+		}
+
+		int RandomLevel(int id) const
+		{
+			// splitmix64 of id gives uniform number, level is geometric with ratio 1/M
+			unsigned long long z = (unsigned long long)(id) + 0x9E3779B97F4A7C15ull * (seed + 1);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			z ^= z >> 31;
+			const double u = (double(z >> 11) + 1) / 9007199254740993.0;
+			const int level = int(-std::log(u) / std::log(double(M)));
+			return level < 16 ? level : 16;
+		}
+
+		VisitedList * AcquireVisited()
+		{
+			std::lock_guard<std::mutex> lock(poolLock);
+			if (pool.empty())
+				return new VisitedList(capacity);
+			VisitedList * v = pool.back().release();
+			pool.pop_back();
+			return v;
+		}
+		void ReleaseVisited(VisitedList * v)
+		{
+			std::lock_guard<std::mutex> lock(poolLock);
+			pool.emplace_back(v);
+		}
+
+		// Moves greedily to closer nodes at given level
+		void Greedy(const T * q, int & ep, float & epDist, int level) const
+		{
+			std::vector<int> links;
+			for (bool moved = true; moved;)
+			{
+				moved = false;
+				ReadLinks(ep, level, links);
+				for (size_t i = 0; i < links.size(); ++i)
+				{
+					const float d = Distance(q, Vector(links[i]));
+					if (d < epDist)
+					{
+						epDist = d;
+						ep = links[i];
+						moved = true;
+					}
+				}
+			}
+		}
+
+		// Best first search at given level, returns up to ef nearest nodes sorted by distance
+		std::vector<Candidate> SearchLayer(const T * q, int ep, float epDist, int ef, int level)
+		{
+			VisitedList * visited = AcquireVisited();
+			visited->Reset();
+			std::priority_queue<Candidate> top;
+			std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates;
+			visited->marks[ep] = visited->tag;
+			top.push(Candidate(epDist, ep));
+			candidates.push(Candidate(epDist, ep));
+
+			std::vector<int> links;
+			while (!candidates.empty())
+			{
+				const Candidate c = candidates.top();
+				if (c.first > top.top().first && int(top.size()) >= ef)
+					break;
+				candidates.pop();
+
+				ReadLinks(c.second, level, links);
+				for (size_t i = 0; i < links.size(); ++i)
+					if (visited->marks[links[i]] != visited->tag)
+						details::Prefetch(Vector(links[i]));
+				for (size_t i = 0; i < links.size(); ++i)
+				{
+					const int nb = links[i];
+					if (visited->marks[nb] == visited->tag) continue;
+					visited->marks[nb] = visited->tag;
+					const float d = Distance(q, Vector(nb));
+					if (int(top.size()) < ef || d < top.top().first)
+					{
+						candidates.push(Candidate(d, nb));
+						top.push(Candidate(d, nb));
+						if (int(top.size()) > ef) top.pop();
+					}
+				}
+			}
+			ReleaseVisited(visited);
+
+			std::vector<Candidate> res(top.size());
+			for (size_t i = res.size(); i-- > 0; top.pop())
+				res[i] = top.top();
+			return res;
+		}
+
+		// Keeps at most m of candidates sorted by distance to base: candidate is kept if it is closer to base
+		// than to every kept one, which spreads links in different directions
+		void SelectNeighbors(std::vector<Candidate> & candidates, int m) const
+		{
+			if (int(candidates.size()) <= m) return;
+			std::vector<Candidate> kept;
+			for (size_t i = 0; i < candidates.size() && int(kept.size()) < m; ++i)
+			{
+				bool good = true;
+				for (size_t j = 0; j < kept.size() && good; ++j)
+					good = Distance(Vector(candidates[i].second), Vector(kept[j].second)) >= candidates[i].first;
+				if (good) kept.push_back(candidates[i]);
+			}
+			candidates.swap(kept);
+		}
+
+		// Adds link from node to id, prunes links of node if there are too many
+		void Connect(int node, int id, float d, int level)
+		{
+			const int m = level ? M : M0;
+			std::lock_guard<std::mutex> lock(locks[node]);
+			int * l = MutableLinks(node, level);
+			if (l[0] < m)
+			{
+				l[++l[0]] = id;
+				return;
+			}
+			std::vector<Candidate> c;
+			c.push_back(Candidate(d, id));
+			for (int i = 1; i <= l[0]; ++i)
+				c.push_back(Candidate(Distance(Vector(node), Vector(l[i])), l[i]));
+			std::sort(c.begin(), c.end());
+			SelectNeighbors(c, m);
+			l[0] = int(c.size());
+			for (size_t i = 0; i < c.size(); ++i) l[i + 1] = c[i].second;
+		}
+
+	public:
+		// Index of up to capacity vectors. M is number of links per node at upper levels (2 * M at level 0),
+		// efConstruction is breadth of search for neighbours during insertion.
+		HnswIndex(int dim, int capacity, int M = 16, int efConstruction = 200, Metric metric = Metric::SquaredL2, unsigned seed = 1)
+			: dim(dim), M(M), M0(2 * M), efConstruction(efConstruction), capacity(capacity), metric(metric), seed(seed), count(0), top(Pack(-1, -1)),
+			vectorStore(size_t(capacity) * dim), levelStore(capacity), links0Store(size_t(capacity) * (2 * M + 1)),
+			upperStore(capacity), locks(new std::mutex[capacity])
+		{
+			vectors = vectorStore.data();
+			levels = levelStore.data();
+			links0 = links0Store.data();
+		}
+
+		// Empty index to Load or Attach
+		HnswIndex() : count(0), top(Pack(-1, -1)) {}
+
+		int Dim() const { return dim; }
+		int Size() const { return std::min(int(count), capacity); }
+
+		// Adds vector, returns its id or -1 if index is full. Thread safe.
+		int Insert(const T * x)
+		{
+			if (readOnly) return -1;
+			const int id = count++;
+			if (id >= capacity) return -1;
+
+			T * v = vectorStore.data() + size_t(id) * dim;
+			std::copy(x, x + dim, v);
+			if (metric == Metric::Cosine)
+			{
+				const double norm = std::sqrt(double(Dot(Vec(v, dim), Vec(v))));
+				if (norm > 0)
+					for (int p = 0; p < dim; ++p) v[p] = T(v[p] / norm);
+			}
+			const int level = RandomLevel(id);
+			{
+				std::lock_guard<std::mutex> lock(locks[id]);
+				levelStore[id] = level;
+				upperStore[id].assign(size_t(level) * (M + 1), 0);
+			}
+
+			// entry lock is held through insertion only by node that becomes new entry point, so other inserters
+			// wait for it while searches go on with the old entry point
+			std::unique_lock<std::mutex> entryHold(entryLock);
+			int ep, curMax;
+			Top(ep, curMax);
+			if (ep < 0)
+			{
+				top.store(Pack(id, level), std::memory_order_release);
+				return id;
+			}
+			if (level <= curMax)
+				entryHold.unlock();
+
+			float epDist = Distance(v, Vector(ep));
+			for (int l = curMax; l > level; --l)
+				Greedy(v, ep, epDist, l);
+			for (int l = std::min(level, curMax); l >= 0; --l)
+			{
+				std::vector<Candidate> c = SearchLayer(v, ep, epDist, efConstruction, l);
+				ep = c[0].second;
+				epDist = c[0].first;
+				SelectNeighbors(c, M);
+				{
+					std::lock_guard<std::mutex> lock(locks[id]);
+					int * links = MutableLinks(id, l);
+					links[0] = int(c.size());
+					for (size_t i = 0; i < c.size(); ++i) links[i + 1] = c[i].second;
+				}
+				for (size_t i = 0; i < c.size(); ++i)
+					Connect(c[i].second, id, c[i].first, l);
+			}
+			// Links of the new entry point are complete before searches can start from it
+			if (level > curMax)
+				top.store(Pack(id, level), std::memory_order_release);
+			return id;
+		}
+
+		// Writes k nearest ids and distances to ids and dists, nearest first. Missing results have id -1.
+		// ef (>= k) is breadth of search at level 0, bigger is more accurate and slower.
+		void Search(const T * query, int k, int ef, int * ids, float * dists)
+		{
+			std::vector<T> normalized;
+			const T * q = query;
+			if (metric == Metric::Cosine)
+			{
+				normalized.assign(query, query + dim);
+				const double norm = std::sqrt(double(Dot(Vec(query, dim), Vec(query))));
+				if (norm > 0)
+					for (int p = 0; p < dim; ++p) normalized[p] = T(normalized[p] / norm);
+				q = normalized.data();
+			}
+
+			int ep, maxLevel;
+			Top(ep, maxLevel);
+			std::vector<Candidate> res;
+			if (ep >= 0)
+			{
+				float epDist = Distance(q, Vector(ep));
+				for (int l = maxLevel; l > 0; --l)
+					Greedy(q, ep, epDist, l);
+				res = SearchLayer(q, ep, epDist, std::max(ef, k), 0);
+			}
+			for (int j = 0; j < k; ++j)
+			{
+				const bool found = j < int(res.size());
+				ids[j] = found ? res[j].second : -1;
+				dists[j] = found ? (metric == Metric::L2 ? std::sqrt(res[j].first) : res[j].first) : std::numeric_limits<float>::max();
+			}
+		}
+
+		// Writes index to file. Must not run concurrently with Insert.
+		bool Save(const char * path) const
+		{
+			const int n = Size();
+			std::vector<long long> offsets(n + 1, 0);
+			for (int i = 0; i < n; ++i)
+				offsets[i + 1] = offsets[i] + levels[i] * (M + 1);
+
+			auto align = [](long long x) { return (x + 63) / 64 * 64; };
+			Header h;
+			std::memset(&h, 0, sizeof(h));
+			std::memcpy(h.magic, "VEVIHNSW", 8);
+			int entry, maxLevel;
+			Top(entry, maxLevel);
+			h.elementSize = int(sizeof(T));
+			h.dim = dim; h.M = M; h.M0 = M0; h.count = n; h.maxLevel = maxLevel; h.entry = entry; h.metric = int(metric);
+			h.vectors = align(sizeof(Header));
+			h.levels = align(h.vectors + (long long)n * dim * sizeof(T));
+			h.links0 = align(h.levels + (long long)n * sizeof(int));
+			h.upperOffsets = align(h.links0 + (long long)n * (M0 + 1) * sizeof(int));
+			h.upper = align(h.upperOffsets + (long long)(n + 1) * sizeof(long long));
+			h.size = align(h.upper + offsets[n] * (long long)sizeof(int));
+
+			std::FILE * f = std::fopen(path, "wb");
+			if (!f) return false;
+			long long pos = 0;
+			bool ok = true;
+			auto put = [&](long long at, const void * data, long long bytes)
+			{
+				static const char zeros[64] = { 0 };
+				for (; ok && pos < at; pos += std::min<long long>(64, at - pos))
+					ok = std::fwrite(zeros, 1, size_t(std::min<long long>(64, at - pos)), f) == size_t(std::min<long long>(64, at - pos));
+				if (ok && bytes) ok = std::fwrite(data, 1, size_t(bytes), f) == size_t(bytes);
+				pos += bytes;
+			};
+			put(0, &h, sizeof(h));
+			put(h.vectors, vectors, (long long)n * dim * sizeof(T));
+			put(h.levels, levels, (long long)n * sizeof(int));
+			put(h.links0, links0, (long long)n * (M0 + 1) * sizeof(int));
+			put(h.upperOffsets, offsets.data(), (long long)(n + 1) * sizeof(long long));
+			for (int i = 0; i < n; ++i)
+			{
+				const long long bytes = (long long)levels[i] * (M + 1) * sizeof(int);
+				put(h.upper + offsets[i] * (long long)sizeof(int), bytes ? Links(i, 1) : nullptr, bytes);
+			}
+			put(h.size, nullptr, 0);
+			return std::fclose(f) == 0 && ok;
+		}
+
+		// Uses index image written by Save, memory has to stay valid while index is used
+		bool Attach(const void * image)
+		{
+			const char * base = static_cast<const char*>(image);
+			Header h;
+			std::memcpy(&h, base, sizeof(h));
+			if (std::memcmp(h.magic, "VEVIHNSW", 8) != 0 || h.elementSize != int(sizeof(T)))
+				return false;
+			dim = h.dim; M = h.M; M0 = h.M0; capacity = h.count; count = h.count;
+			top.store(Pack(h.entry, h.maxLevel)); metric = Metric(h.metric);
+			vectors = reinterpret_cast<const T*>(base + h.vectors);
+			levels = reinterpret_cast<const int*>(base + h.levels);
+			links0 = reinterpret_cast<const int*>(base + h.links0);
+			upperOffsets = reinterpret_cast<const long long*>(base + h.upperOffsets);
+			upperFlat = reinterpret_cast<const int*>(base + h.upper);
+			readOnly = true;
+			pool.clear();
+			return true;
+		}
+
+		// Reads index written by Save with single read
+		bool Load(const char * path)
+		{
+			std::FILE * f = std::fopen(path, "rb");
+			if (!f) return false;
+			Header h;
+			bool ok = std::fread(&h, sizeof(h), 1, f) == 1 && std::fseek(f, 0, SEEK_SET) == 0;
+			if (ok)
+			{
+				imageBuffer.assign(size_t((h.size + 7) / 8), 0);
+				ok = std::fread(imageBuffer.data(), 1, size_t(h.size), f) == size_t(h.size);
+			}
+			std::fclose(f);
+			return ok && Attach(imageBuffer.data());
+		}
+	};
+}
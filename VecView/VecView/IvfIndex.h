@@ -0,0 +1,233 @@
+//
+// Inverted file (IVF) index for approximate nearest neighbour search.
+// Vectors are partitioned by nearest coarse centroid (trained with k-means) into lists that are stored contiguously.
+// Search scores query against centroids, then scans only nprobe nearest lists.
+// Optionally vectors in lists are kept as int8 codes with per-dimention scale, which cuts memory traffic of scans 4 times for floats.
+// With Metric::Cosine vectors, centroids and queries are normalized, so L2 to centroids ranks lists by cosine
+// and training is spherical k-means.
+//
+// Use example:
+//
+// IvfIndex<float> index(dim, 1024);
+// index.Train(Mat(sample, nsample, dim));
+// index.Add(Mat(base, nbase, dim));
+// index.Search(Mat(queries, nq, dim), 10, 16, ids, dists); // 10 nearest of every query, 16 lists probed
+//
+
+#pragma once
+
+#include "VecView.h"
+#include "KMeans.h"
+#include <cstdint>
+#include <algorithm>
+#include <utility>
+#include <iterator>
+#include <limits>
+
+namespace vevi
+{
+	template<typename T>
+	class IvfIndex
+	{
+		struct List
+		{
+			std::vector<T> vectors;
+			std::vector<std::int8_t> codes;
+			std::vector<float> norms;
+			std::vector<int> ids;
+		};
+
+		const int dim, nlist;
+		const Metric metric;
+		const bool int8;
+		std::vector<T> centroids;
+		std::vector<float> centroidNorms;
+		std::vector<float> scale;
+		std::vector<List> lists;
+		int count = 0;
+
+		// Scales floating point vector to unit length for cosine metric
+		void Normalize(T * x) const
+		{
+			if (metric != Metric::Cosine || !std::is_floating_point<T>::value)
+				return;
+			const float norm = std::sqrt(details::DotKernel<float>(x, x, dim));
+			if (norm > 0)
+				for (int p = 0; p < dim; ++p) x[p] = T(x[p] / norm);
+		}
+
+		int Nearest(const T * x) const
+		{
+			int best = 0;
+			float bestDist = std::numeric_limits<float>::max();
+			for (int c = 0; c < nlist; ++c)
+			{
+				const float d = centroidNorms[c] - 2 * details::DotKernel<float>(x, &centroids[size_t(c) * dim], dim);
+				if (d < bestDist)
+				{
+					bestDist = d;
+					best = c;
+				}
+			}
+			return best;
+		}
+
+		float Distance(float dot, float qnorm, float xnorm) const
+		{
+			if (metric == Metric::Cosine)
+			{
+				const float nn = qnorm * xnorm;
+				return nn > 0 ? std::min(std::max(1 - dot / std::sqrt(nn), 0.f), 2.f) : 1.f;
+			}
+			const float d = std::max(qnorm + xnorm - 2 * dot, 0.f);
+			return metric == Metric::L2 ? std::sqrt(d) : d;
+		}
+
+		void SearchOne(const T * q, int k, int nprobe, int * outIds, float * outDists, std::vector<float> & qs) const
+		{
+			std::vector<std::pair<float, int>> probe(nlist);
+			for (int c = 0; c < nlist; ++c)
+				probe[c] = std::make_pair(centroidNorms[c] - 2 * details::DotKernel<float>(q, &centroids[size_t(c) * dim], dim), c);
+			nprobe = std::min(nprobe, nlist);
+			std::partial_sort(probe.begin(), std::next(probe.begin(), nprobe), probe.end());
+
+			const float qnorm = details::DotKernel<float>(q, q, dim);
+			if (int8)
+				for (int p = 0; p < dim; ++p) qs[p] = float(q[p]) * scale[p];
+
+			// max-heap of k best so far
+			std::vector<std::pair<float, int>> heap;
+			heap.reserve(k + 1);
+			for (int l = 0; l < nprobe; ++l)
+			{
+				const List & list = lists[probe[l].second];
+				const int size = int(list.ids.size());
+				for (int i = 0; i < size; ++i)
+				{
+					const float dot = int8
+						? details::DotKernel<float>(qs.data(), &list.codes[size_t(i) * dim], dim)
+						: details::DotKernel<float>(q, &list.vectors[size_t(i) * dim], dim);
+					const float d = Distance(dot, qnorm, list.norms[i]);
+					if (int(heap.size()) < k)
+					{
+						heap.push_back(std::make_pair(d, list.ids[i]));
+						std::push_heap(heap.begin(), heap.end());
+					}
+					else if (k > 0 && d < heap.front().first)
+					{
+						std::pop_heap(heap.begin(), heap.end());
+						heap.back() = std::make_pair(d, list.ids[i]);
+						std::push_heap(heap.begin(), heap.end());
+					}
+				}
+			}
+			std::sort_heap(heap.begin(), heap.end());
+			for (int j = 0; j < k; ++j)
+			{
+				outIds[j] = j < int(heap.size()) ? heap[j].second : -1;
+				outDists[j] = j < int(heap.size()) ? heap[j].first : std::numeric_limits<float>::max();
+			}
+		}
+
+	public:
+		// metric is used for ranking in lists, vectors are assigned to lists by L2 to centroids (of normalized vectors for Cosine).
+		IvfIndex(int dim, int nlist, Metric metric = Metric::SquaredL2, bool int8 = false)
+			: dim(dim), nlist(nlist), metric(metric), int8(int8), lists(nlist) {}
+
+		int Dim() const { return dim; }
+		int Size() const { return count; }
+		int ListSize(int l) const { return int(lists[l].ids.size()); }
+
+		// Trains coarse centroids (and int8 scales) on rows of sample. Has to be called before Add.
+		template<typename Ptr>
+		void Train(const details::MatrixView<Ptr> & sample, unsigned seed = 1)
+		{
+			KMeansParams params(nlist);
+			params.seed = seed;
+			std::vector<T> rows(size_t(sample.Rows()) * dim);
+			for (int i = 0; i < sample.Rows(); ++i)
+			{
+				for (int p = 0; p < dim; ++p) rows[size_t(i) * dim + p] = T(sample.RowPtr(i)[p]);
+				Normalize(&rows[size_t(i) * dim]);
+			}
+			auto c = KMeans(Mat(rows.data(), sample.Rows(), dim), params);
+			centroids.assign(c.Data(), c.Data() + size_t(nlist) * dim);
+			for (int l = 0; l < nlist; ++l)
+				Normalize(&centroids[size_t(l) * dim]);
+			centroidNorms.resize(nlist);
+			for (int l = 0; l < nlist; ++l)
+				centroidNorms[l] = details::DotKernel<float>(&centroids[size_t(l) * dim], &centroids[size_t(l) * dim], dim);
+
+			if (int8)
+			{
+				scale.assign(dim, 0.f);
+				for (int i = 0; i < sample.Rows(); ++i)
+					for (int p = 0; p < dim; ++p) scale[p] = std::max(scale[p], std::abs(float(rows[size_t(i) * dim + p])));
+				for (int p = 0; p < dim; ++p) scale[p] = scale[p] > 0 ? scale[p] / 127 : 1.f;
+			}
+		}
+
+		// Adds rows of data with given ids, by default ids continue numbering of added vectors
+		template<typename Ptr>
+		void Add(const details::MatrixView<Ptr> & data, const int * ids = nullptr)
+		{
+			const int n = data.Rows();
+			std::vector<T> x(dim);
+			std::vector<int> target(n);
+			details::ParallelFor(n, 256, [&](int begin, int end, int)
+			{
+				std::vector<T> row(dim);
+				for (int i = begin; i < end; ++i)
+				{
+					for (int p = 0; p < dim; ++p) row[p] = T(data.RowPtr(i)[p]);
+					Normalize(row.data());
+					target[i] = Nearest(row.data());
+				}
+			});
+			for (int i = 0; i < n; ++i)
+			{
+				List & list = lists[target[i]];
+				for (int p = 0; p < dim; ++p) x[p] = T(data.RowPtr(i)[p]);
+				Normalize(x.data());
+				float norm;
+				if (int8)
+				{
+					norm = 0;
+					for (int p = 0; p < dim; ++p)
+					{
+						const float v = std::round(float(x[p]) / scale[p]);
+						const std::int8_t code = std::int8_t(std::max(-127.f, std::min(127.f, v)));
+						list.codes.push_back(code);
+						norm += (code * scale[p]) * (code * scale[p]);
+					}
+				}
+				else
+				{
+					list.vectors.insert(list.vectors.end(), x.begin(), x.end());
+					norm = details::DotKernel<float>(x.data(), x.data(), dim);
+				}
+				list.norms.push_back(norm);
+				list.ids.push_back(ids ? ids[i] : count + i);
+			}
+			count += n;
+		}
+
+		// Writes k nearest ids and distances for every row of queries to rows of ids and dists (nq x k),
+		// nearest first. Missing results have id -1. Queries are distributed between threads.
+		template<typename Ptr>
+		void Search(const details::MatrixView<Ptr> & queries, int k, int nprobe, int * ids, float * dists) const
+		{
+			details::ParallelFor(queries.Rows(), 4, [&](int begin, int end, int)
+			{
+				std::vector<T> q(dim);
+				std::vector<float> qs(dim);
+				for (int i = begin; i < end; ++i)
+				{
+					for (int p = 0; p < dim; ++p) q[p] = T(queries.RowPtr(i)[p]);
+					Normalize(q.data());
+					SearchOne(q.data(), k, nprobe, ids + size_t(i) * k, dists + size_t(i) * k, qs);
+				}
+			});
+		}
+	};
+}
@@ -0,0 +1,208 @@
+//
+// K-means clustering of vectors stored in rows of a matrix view.
+// Initialization is k-means++, then Lloyd iterations are done until assignments stop changing,
+// relative improvement of inertia (sum of squared distances to nearest centroids) drops below tolerance,
+// or maxIterations updates are done.
+//
+// Use example:
+//
+// KMeansParams params(256);
+// auto centroids = KMeans(Mat(points, n, dim), params, labels); // centroids is OwnedArray<float> of 256 x dim
+// float d = Dot(Vec(centroids.Data(), dim), Vec(query));
+//
+
+#pragma once
+
+#include "VecView.h"
+#include <random>
+#include <algorithm>
+#include <limits>
+
+namespace vevi
+{
+	struct KMeansParams
+	{
+		int k;
+		int maxIterations;
+		double tolerance;
+		unsigned seed;
+		KMeansParams(int k) : k(k), maxIterations(25), tolerance(1e-4), seed(1) {}
+	};
+
+	namespace details
+	{
+		template<typename T1, typename T2>
+		inline double SquaredL2Kernel(const T1 * a, const T2 * b, int dim)
+		{
+			double s = 0;
+			for (int p = 0; p < dim; ++p)
+			{
+				const double t = double(a[p]) - double(b[p]);
+				s += t * t;
+			}
+			return s;
+		}
+
+		// Finds nearest centroid for every row of data. Blocks of rows are distributed between threads and
+		// distances to centroids are computed by DotTile as |x|^2 + |c|^2 - 2 x.c.
+		// Returns inertia, changed is set to number of rows that got different label.
+		template<typename Ptr, typename T>
+		inline double AssignNearest(const MatrixView<Ptr> & data, const MatrixView<T*> & centroids,
+			const std::vector<double> & xnorm, int * label, double * dist, int & changed)
+		{
+			const int n = data.Rows(), k = centroids.Rows(), d = data.Cols();
+			const int block = 256, tile = 64;
+			std::vector<double> cnorm(k);
+			for (int c = 0; c < k; ++c) cnorm[c] = DotKernel<double>(centroids.RowPtr(c), centroids.RowPtr(c), d);
+
+			const int threads = ParallelThreads(n, block);
+			std::vector<double> inertia(threads, 0.0);
+			std::vector<int> moved(threads, 0);
+			std::vector<int> nearest(n);
+			ParallelFor(n, block, [&](int begin, int end, int t)
+			{
+				for (int i = begin; i < end; ++i) dist[i] = std::numeric_limits<double>::max();
+				auto keep = [&](int i, int c, double dot)
+				{
+					double d2 = xnorm[i] + cnorm[c] - 2 * dot;
+					d2 = d2 < 0 ? 0 : d2;
+					if (d2 < dist[i])
+					{
+						dist[i] = d2;
+						nearest[i] = c;
+					}
+				};
+				for (int jb = 0; jb < k; jb += tile)
+					DotTile<double>(data, begin, end, centroids, jb, jb + tile < k ? jb + tile : k, keep);
+				for (int i = begin; i < end; ++i)
+				{
+					inertia[t] += dist[i];
+					if (label[i] != nearest[i])
+					{
+						label[i] = nearest[i];
+						++moved[t];
+					}
+				}
+			});
+
+			double total = 0;
+			changed = 0;
+			for (int t = 0; t < threads; ++t)
+			{
+				total += inertia[t];
+				changed += moved[t];
+			}
+			return total;
+		}
+	}
+
+	// Clusters rows of data into params.k clusters. Returns centroids (k x dim, row by row).
+	// If labels is given, it receives index of nearest centroid for every row.
+	template<typename Ptr>
+	inline details::storages::OwnedArray<typename details::MatrixView<Ptr>::type> KMeans(const details::MatrixView<Ptr> & data,
+		const KMeansParams & params, int * labels = nullptr)
+	{
+		using T = typename details::MatrixView<Ptr>::type;
+		const int n = data.Rows(), d = data.Cols(), k = params.k;
+		details::storages::OwnedArray<T> storage(k * d);
+		const details::MatrixView<T*> centroids(storage.Data(), k, d, d);
+		if (n == 0)
+		{
+			for (int i = 0; i < k * d; ++i) storage[i] = T(0);
+			return storage;
+		}
+
+		std::vector<double> xnorm(n), dist(n);
+		details::ParallelFor(n, 1024, [&](int begin, int end, int)
+		{
+			for (int i = begin; i < end; ++i) xnorm[i] = details::DotKernel<double>(data.RowPtr(i), data.RowPtr(i), d);
+		});
+
+		// k-means++: every next centroid is a row chosen with probability proportional to squared distance to nearest chosen one
+		std::mt19937 rng(params.seed);
+		int pick = std::uniform_int_distribution<int>(0, n - 1)(rng);
+		for (int c = 0; c < k; ++c)
+		{
+			for (int p = 0; p < d; ++p) centroids.RowPtr(c)[p] = T(data.RowPtr(pick)[p]);
+			if (c + 1 == k) break;
+
+			const T * cp = centroids.RowPtr(c);
+			details::ParallelFor(n, 1024, [&](int begin, int end, int)
+			{
+				for (int i = begin; i < end; ++i)
+				{
+					const double d2 = details::SquaredL2Kernel(data.RowPtr(i), cp, d);
+					dist[i] = c == 0 || d2 < dist[i] ? d2 : dist[i];
+				}
+			});
+			double total = 0;
+			for (int i = 0; i < n; ++i) total += dist[i];
+			if (total > 0)
+			{
+				double r = std::uniform_real_distribution<double>(0, total)(rng);
+				pick = n - 1;
+				for (int i = 0; i < n; ++i)
+				{
+					r -= dist[i];
+					if (r < 0 && dist[i] > 0)
+					{
+						pick = i;
+						break;
+					}
+				}
+			}
+			else
+				pick = std::uniform_int_distribution<int>(0, n - 1)(rng);
+		}
+
+		// Lloyd iterations
+		std::vector<int> label(n, -1);
+		std::vector<double> sums(size_t(k) * d);
+		std::vector<int> counts(k);
+		double prev = std::numeric_limits<double>::max();
+		for (int it = 0;; ++it)
+		{
+			int changed = 0;
+			const double inertia = details::AssignNearest(data, centroids, xnorm, label.data(), dist.data(), changed);
+			if (changed == 0 || it == params.maxIterations || prev - inertia <= params.tolerance * prev)
+				break;
+			prev = inertia;
+
+			std::fill(sums.begin(), sums.end(), 0.0);
+			std::fill(counts.begin(), counts.end(), 0);
+			for (int i = 0; i < n; ++i)
+			{
+				double * s = sums.data() + size_t(label[i]) * d;
+				const Ptr x = data.RowPtr(i);
+				for (int p = 0; p < d; ++p) s[p] += double(x[p]);
+				++counts[label[i]];
+			}
+			for (int c = 0; c < k; ++c)
+			{
+				if (counts[c] == 0) continue;
+				const double * s = sums.data() + size_t(c) * d;
+				for (int p = 0; p < d; ++p) centroids.RowPtr(c)[p] = T(s[p] / counts[c]);
+			}
+			// Empty cluster takes the row farthest from its centroid among clusters that can spare one
+			for (int c = 0; c < k; ++c)
+			{
+				if (counts[c] != 0) continue;
+				int far = -1;
+				for (int i = 0; i < n; ++i)
+					if (counts[label[i]] > 1 && (far < 0 || dist[i] > dist[far]))
+						far = i;
+				if (far < 0) break;
+				const Ptr x = data.RowPtr(far);
+				for (int p = 0; p < d; ++p) centroids.RowPtr(c)[p] = T(x[p]);
+				--counts[label[far]];
+				label[far] = c;
+				counts[c] = 1;
+				dist[far] = 0;
+			}
+		}
+
+		if (labels)
+			std::copy(label.begin(), label.end(), labels);
+		return storage;
+	}
+}
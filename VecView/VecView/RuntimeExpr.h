@@ -0,0 +1,528 @@
+//
+// Expressions composed at runtime, i.e. feature pipelines read from a config.
+// RuntimeExpr is a type-erased tree of the library's element-wise operations over numbered input vectors and constants.
+// RuntimeProgram compiles it into code for a register machine whose registers are blocks of 256 coordinates.
+// Every instruction processes a whole block with a tight loop that compilers vectorize, so the cost of dispatch
+// is paid once per 256 coordinates and a block of all registers stays in L1.
+// Instructions are superinstructions: besides op(a, b) there are op(op(a, b), c), op(c, op(a, b)) and
+// op(op(a, b), op(c, d)), whose operands are inputs and constants read in place or registers, and u(op(a, b)) for
+// a unary u. The compiler tiles the tree with the largest of them after folding negations into subtractions and
+// constants, so a * b + c, (x - y) * (x + y) or a / b - c * d are single passes over a block.
+// A pipeline of several operations still makes a pass per instruction where the template makes one and runs about
+// 1.5 - 2 times slower than the same expression template (see benchmarks in VecView.cpp, run with "VecView bench").
+// Use templates for pipelines known at compile time, runtime ones only pay for flexibility.
+//
+// Use example:
+//
+// auto x = RuntimeExpr<float>::Input(0), y = RuntimeExpr<float>::Input(1);
+// RuntimeExpr<float> e = Abs(x - y) * RuntimeExpr<float>::Const(0.5f);   // or RuntimeExpr<float>::Binary(RuntimeOp::Mul, ...)
+// RuntimeProgram<float> program(e);
+// const float * inputs[] = { a, b };
+// program.Evaluate(inputs, n, out);                                      // out = |a - b| * 0.5
+//
+
+#pragma once
+
+#include "VecView.h"
+#include <memory>
+#include <vector>
+#include <cmath>
+#include <cassert>
+
+namespace vevi
+{
+	enum class RuntimeOp
+	{
+		Input,
+		Const,
+		Add,
+		Sub,
+		Mul,
+		Div,
+		Min,
+		Max,
+		Neg,
+		Abs,
+		Sqrt
+	};
+
+	namespace details
+	{
+		inline bool IsBinaryOp(RuntimeOp op)
+		{
+			return op == RuntimeOp::Add || op == RuntimeOp::Sub || op == RuntimeOp::Mul || op == RuntimeOp::Div ||
+				op == RuntimeOp::Min || op == RuntimeOp::Max;
+		}
+
+		inline bool IsUnaryOp(RuntimeOp op) { return op == RuntimeOp::Neg || op == RuntimeOp::Abs || op == RuntimeOp::Sqrt; }
+	}
+
+	template<typename T>
+	class RuntimeExpr
+	{
+		struct Node
+		{
+			RuntimeOp op;
+			int input;
+			T value;
+			std::shared_ptr<const Node> a, b;
+		};
+		std::shared_ptr<const Node> node;
+
+		RuntimeExpr(std::shared_ptr<const Node> node) : node(std::move(node)) {}
+
+		template<typename U>
+		friend class RuntimeProgram;
+
+	public:
+		// k-th input vector given to RuntimeProgram::Evaluate
+		static RuntimeExpr<T> Input(int k)
+		{
+			Node n = { RuntimeOp::Input, k, T(0), nullptr, nullptr };
+			return RuntimeExpr<T>(std::make_shared<const Node>(n));
+		}
+		static RuntimeExpr<T> Const(T value)
+		{
+			Node n = { RuntimeOp::Const, -1, value, nullptr, nullptr };
+			return RuntimeExpr<T>(std::make_shared<const Node>(n));
+		}
+		// op is one of Add, Sub, Mul, Div, Min, Max
+		static RuntimeExpr<T> Binary(RuntimeOp op, const RuntimeExpr<T> & a, const RuntimeExpr<T> & b)
+		{
+			assert(details::IsBinaryOp(op));
+			Node n = { op, -1, T(0), a.node, b.node };
+			return RuntimeExpr<T>(std::make_shared<const Node>(n));
+		}
+		// op is one of Neg, Abs, Sqrt
+		static RuntimeExpr<T> Unary(RuntimeOp op, const RuntimeExpr<T> & a)
+		{
+			assert(details::IsUnaryOp(op));
+			Node n = { op, -1, T(0), a.node, nullptr };
+			return RuntimeExpr<T>(std::make_shared<const Node>(n));
+		}
+	};
+
+	template<typename T>
+	inline RuntimeExpr<T> operator+(const RuntimeExpr<T> & a, const RuntimeExpr<T> & b) { return RuntimeExpr<T>::Binary(RuntimeOp::Add, a, b); }
+	template<typename T>
+	inline RuntimeExpr<T> operator-(const RuntimeExpr<T> & a, const RuntimeExpr<T> & b) { return RuntimeExpr<T>::Binary(RuntimeOp::Sub, a, b); }
+	template<typename T>
+	inline RuntimeExpr<T> operator*(const RuntimeExpr<T> & a, const RuntimeExpr<T> & b) { return RuntimeExpr<T>::Binary(RuntimeOp::Mul, a, b); }
+	template<typename T>
+	inline RuntimeExpr<T> operator/(const RuntimeExpr<T> & a, const RuntimeExpr<T> & b) { return RuntimeExpr<T>::Binary(RuntimeOp::Div, a, b); }
+	template<typename T>
+	inline RuntimeExpr<T> operator-(const RuntimeExpr<T> & a) { return RuntimeExpr<T>::Unary(RuntimeOp::Neg, a); }
+	template<typename T>
+	inline RuntimeExpr<T> Min(const RuntimeExpr<T> & a, const RuntimeExpr<T> & b) { return RuntimeExpr<T>::Binary(RuntimeOp::Min, a, b); }
+	template<typename T>
+	inline RuntimeExpr<T> Max(const RuntimeExpr<T> & a, const RuntimeExpr<T> & b) { return RuntimeExpr<T>::Binary(RuntimeOp::Max, a, b); }
+	template<typename T>
+	inline RuntimeExpr<T> Abs(const RuntimeExpr<T> & a) { return RuntimeExpr<T>::Unary(RuntimeOp::Abs, a); }
+	template<typename T>
+	inline RuntimeExpr<T> Sqrt(const RuntimeExpr<T> & a) { return RuntimeExpr<T>::Unary(RuntimeOp::Sqrt, a); }
+
+	namespace details
+	{
+		struct RuntimeAdd { template<typename T> static T Apply(T a, T b) { return a + b; } };
+		struct RuntimeSub { template<typename T> static T Apply(T a, T b) { return a - b; } };
+		struct RuntimeMul { template<typename T> static T Apply(T a, T b) { return a * b; } };
+		struct RuntimeDiv { template<typename T> static T Apply(T a, T b) { return a / b; } };
+		struct RuntimeMin { template<typename T> static T Apply(T a, T b) { return b < a ? b : a; } };
+		struct RuntimeMax { template<typename T> static T Apply(T a, T b) { return a < b ? b : a; } };
+		struct RuntimeCopy { template<typename T> static T Apply(T a) { return a; } };
+		struct RuntimeNeg { template<typename T> static T Apply(T a) { return -a; } };
+		struct RuntimeAbs { template<typename T> static T Apply(T a) { return a < T(0) ? -a : a; } };
+		struct RuntimeSqrt { template<typename T> static T Apply(T a) { return T(std::sqrt(a)); } };
+
+		// Kernels over a block of N coordinates. Operands are blocks (registers, inputs or constants filled into a block),
+		// the destination is none of them, so the loops have a constant length and __restrict pointers and compilers
+		// vectorize them without remainder handling and runtime alias checks. Binary ops of a family come first.
+		template<int N, typename T>
+		struct RuntimeKernels
+		{
+			// d = Post(a), loads and unary operations
+			struct Unary
+			{
+				static const int binaries = 0, arity = 1;
+				template<typename Post>
+				static void Run(T * __restrict d, const T * __restrict a, const T *, const T *, const T *)
+				{
+					for (int i = 0; i < N; ++i) d[i] = Post::Apply(a[i]);
+				}
+			};
+
+			// d = Post(Op(a, b))
+			struct Binary
+			{
+				static const int binaries = 1, arity = 2;
+				template<typename Op, typename Post>
+				static void Run(T * __restrict d, const T * __restrict a, const T * __restrict b, const T *, const T *)
+				{
+					for (int i = 0; i < N; ++i) d[i] = Post::Apply(Op::Apply(a[i], b[i]));
+				}
+			};
+
+			// d = Op2(Op1(a, b), c), i.e. a * b + c
+			struct Left
+			{
+				static const int binaries = 2, arity = 2;
+				template<typename Op1, typename Op2>
+				static void Run(T * __restrict d, const T * __restrict a, const T * __restrict b, const T * __restrict c, const T *)
+				{
+					for (int i = 0; i < N; ++i) d[i] = Op2::Apply(Op1::Apply(a[i], b[i]), c[i]);
+				}
+			};
+
+			// d = Op2(c, Op1(a, b)), i.e. c - a * b
+			struct Right
+			{
+				static const int binaries = 2, arity = 2;
+				template<typename Op1, typename Op2>
+				static void Run(T * __restrict d, const T * __restrict a, const T * __restrict b, const T * __restrict c, const T *)
+				{
+					for (int i = 0; i < N; ++i) d[i] = Op2::Apply(c[i], Op1::Apply(a[i], b[i]));
+				}
+			};
+
+			// d = Op3(Op1(a, b), Op2(c, e)), i.e. a * b + c * e
+			struct Pair
+			{
+				static const int binaries = 3, arity = 3;
+				template<typename Op1, typename Op2, typename Op3>
+				static void Run(T * __restrict d, const T * __restrict a, const T * __restrict b, const T * __restrict c,
+					const T * __restrict e)
+				{
+					// two operations on the same operands, i.e. (a - b) / (a + b), read them once
+					if (c == a && e == b)
+						for (int i = 0; i < N; ++i) d[i] = Op3::Apply(Op1::Apply(a[i], b[i]), Op2::Apply(a[i], b[i]));
+					else
+						for (int i = 0; i < N; ++i) d[i] = Op3::Apply(Op1::Apply(a[i], b[i]), Op2::Apply(c[i], e[i]));
+				}
+			};
+		};
+	}
+
+	template<typename T>
+	class RuntimeProgram
+	{
+		static const int Block = 256;
+
+		typedef typename RuntimeExpr<T>::Node Node;
+		typedef std::shared_ptr<const Node> NodePtr;
+		typedef details::RuntimeKernels<Block, T> Kernels;
+		typedef void(*Kernel)(T * d, const T * a, const T * b, const T * c, const T * e);
+
+		// Operand of an instruction: register of the stack, input vector or constant
+		struct Source
+		{
+			int reg;
+			int input;
+			int constant;
+		};
+
+		// dst = kernel(src...), dst is a register that no source reads
+		struct Instruction
+		{
+			Kernel kernel;
+			int dst;
+			Source src[4];
+		};
+
+		std::vector<Instruction> code;
+		std::vector<T> constants; // a block of every constant, shared by all evaluations
+		int registers = 0;
+		int inputs = 0;
+
+		static bool IsLeaf(RuntimeOp op) { return op == RuntimeOp::Input || op == RuntimeOp::Const; }
+
+		static NodePtr Make(RuntimeOp op, const NodePtr & a, const NodePtr & b)
+		{
+			Node n = { op, -1, T(0), a, b };
+			return std::make_shared<const Node>(n);
+		}
+
+		static bool IsNeg(const NodePtr & node) { return node->op == RuntimeOp::Neg; }
+
+		// Moves negations up the tree until a constant, an addition or a subtraction absorbs them: -x * c is x * c
+		// negated, a + -b is a - b, so a negation rarely costs a pass of its own. The rewrites are exact for floats
+		// and integers.
+		static NodePtr Simplify(const NodePtr & node)
+		{
+			if (IsLeaf(node->op))
+				return node;
+			const NodePtr a = Simplify(node->a), b = node->b ? Simplify(node->b) : nullptr;
+			switch (node->op)
+			{
+			case RuntimeOp::Neg:
+				if (IsNeg(a))
+					return a->a;
+				if (a->op == RuntimeOp::Const)
+					return RuntimeExpr<T>::Const(-a->value).node;
+				break;
+			case RuntimeOp::Add:
+				if (IsNeg(b))
+					return Make(RuntimeOp::Sub, a, b->a);
+				if (IsNeg(a))
+					return Make(RuntimeOp::Sub, b, a->a);
+				break;
+			case RuntimeOp::Sub:
+				if (IsNeg(b))
+					return Make(RuntimeOp::Add, a, b->a);
+				if (IsNeg(a))
+					return Make(RuntimeOp::Neg, Make(RuntimeOp::Add, a->a, b), nullptr);
+				break;
+			case RuntimeOp::Mul:
+			case RuntimeOp::Div:
+				if (IsNeg(a) || IsNeg(b))
+				{
+					const NodePtr m = Make(node->op, IsNeg(a) ? a->a : a, IsNeg(b) ? b->a : b);
+					return IsNeg(a) != IsNeg(b) ? Make(RuntimeOp::Neg, m, nullptr) : m;
+				}
+				break;
+			default:
+				break;
+			}
+			return a == node->a && b == node->b ? node : Make(node->op, a, b);
+		}
+
+		// Leaves are read in place, other nodes are evaluated into register reg first
+		Source Operand(const Node * node, int reg)
+		{
+			Source s = { -1, -1, -1 };
+			if (node->op == RuntimeOp::Input)
+			{
+				s.input = node->input;
+				if (node->input + 1 > inputs)
+					inputs = node->input + 1;
+			}
+			else if (node->op == RuntimeOp::Const)
+			{
+				s.constant = int(constants.size() / Block);
+				constants.insert(constants.end(), Block, node->value);
+			}
+			else
+			{
+				Compile(node, reg);
+				s.reg = reg;
+			}
+			return s;
+		}
+
+		template<typename Family>
+		void Emit(int reg, const RuntimeOp * ops, const Node * const * operands)
+		{
+			Instruction ins = { Select<Family>(ops), reg, {} };
+			// every operand gets a register of its own above reg, so none of them is overwritten before it is read
+			int next = reg + 1;
+			for (int k = 0; k < 4; ++k)
+			{
+				ins.src[k].reg = ins.src[k].input = ins.src[k].constant = -1;
+				if (operands[k])
+				{
+					ins.src[k] = Operand(operands[k], next);
+					if (ins.src[k].reg == next)
+						++next;
+				}
+			}
+			code.push_back(ins);
+			if (reg + 1 > registers)
+				registers = reg + 1;
+		}
+
+		// Evaluates subtree into register reg, registers above it are free. Instructions take as much of the tree as
+		// they can: a binary operation takes in binary operations that are its operands, up to op(op(a, b), op(c, e)),
+		// and a unary one the binary operation computing its operand. Leaves are read in place.
+		void Compile(const Node * node, int reg)
+		{
+			const RuntimeOp copy = RuntimeOp::Input;
+			if (IsLeaf(node->op))
+			{
+				const Node * operands[] = { node, nullptr, nullptr, nullptr };
+				Emit<typename Kernels::Unary>(reg, &copy, operands);
+			}
+			else if (details::IsUnaryOp(node->op))
+			{
+				assert(node->a && !node->b);
+				const Node * a = node->a.get();
+				if (details::IsBinaryOp(a->op) && !details::IsBinaryOp(a->a->op) && !details::IsBinaryOp(a->b->op))
+				{
+					const RuntimeOp ops[] = { a->op, node->op };
+					const Node * operands[] = { a->a.get(), a->b.get(), nullptr, nullptr };
+					Emit<typename Kernels::Binary>(reg, ops, operands);
+				}
+				else
+				{
+					const Node * operands[] = { a, nullptr, nullptr, nullptr };
+					Emit<typename Kernels::Unary>(reg, &node->op, operands);
+				}
+			}
+			else
+			{
+				assert(details::IsBinaryOp(node->op) && node->a && node->b);
+				const Node * a = node->a.get(), * b = node->b.get();
+				const bool left = details::IsBinaryOp(a->op), right = details::IsBinaryOp(b->op);
+				if (left && right)
+				{
+					const RuntimeOp ops[] = { a->op, b->op, node->op };
+					const Node * operands[] = { a->a.get(), a->b.get(), b->a.get(), b->b.get() };
+					Emit<typename Kernels::Pair>(reg, ops, operands);
+				}
+				else if (left || right)
+				{
+					const Node * inner = left ? a : b;
+					const RuntimeOp ops[] = { inner->op, node->op };
+					const Node * operands[] = { inner->a.get(), inner->b.get(), left ? b : a, nullptr };
+					if (left)
+						Emit<typename Kernels::Left>(reg, ops, operands);
+					else
+						Emit<typename Kernels::Right>(reg, ops, operands);
+				}
+				else
+				{
+					const RuntimeOp ops[] = { node->op, copy };
+					const Node * operands[] = { a, b, nullptr, nullptr };
+					Emit<typename Kernels::Binary>(reg, ops, operands);
+				}
+			}
+		}
+
+		// Kernel of a family for ops, each op becomes a template argument in turn
+		template<typename Family, typename... Ops>
+		static Kernel Select(const RuntimeOp * ops)
+		{
+			return Select<Family, Ops...>(ops, std::integral_constant<int, sizeof...(Ops) == Family::arity ? 0 :
+				int(sizeof...(Ops)) < Family::binaries ? 1 : 2>());
+		}
+
+		template<typename Family, typename... Ops>
+		static Kernel Select(const RuntimeOp *, std::integral_constant<int, 0>)
+		{
+			return &Family::template Run<Ops...>;
+		}
+
+		template<typename Family, typename... Ops>
+		static Kernel Select(const RuntimeOp * ops, std::integral_constant<int, 1>)
+		{
+			switch (ops[sizeof...(Ops)])
+			{
+			case RuntimeOp::Add: return Select<Family, Ops..., details::RuntimeAdd>(ops);
+			case RuntimeOp::Sub: return Select<Family, Ops..., details::RuntimeSub>(ops);
+			case RuntimeOp::Mul: return Select<Family, Ops..., details::RuntimeMul>(ops);
+			case RuntimeOp::Div: return Select<Family, Ops..., details::RuntimeDiv>(ops);
+			case RuntimeOp::Min: return Select<Family, Ops..., details::RuntimeMin>(ops);
+			default: return Select<Family, Ops..., details::RuntimeMax>(ops);
+			}
+		}
+
+		// unary ops, Input stands for a copy
+		template<typename Family, typename... Ops>
+		static Kernel Select(const RuntimeOp * ops, std::integral_constant<int, 2>)
+		{
+			switch (ops[sizeof...(Ops)])
+			{
+			case RuntimeOp::Neg: return Select<Family, Ops..., details::RuntimeNeg>(ops);
+			case RuntimeOp::Abs: return Select<Family, Ops..., details::RuntimeAbs>(ops);
+			case RuntimeOp::Sqrt: return Select<Family, Ops..., details::RuntimeSqrt>(ops);
+			default: return Select<Family, Ops..., details::RuntimeCopy>(ops);
+			}
+		}
+
+		// Blocks of the stack: registers 1 and up, inputs of the last partial block and its result.
+		// Register 0 keeps the result and is given for every block.
+		T * Address(int reg, T * result, T * stack) const
+		{
+			return reg ? stack + size_t(reg - 1) * Block : result;
+		}
+
+		T * Staged(int k, T * stack) const { return stack + size_t(registers - 1 + k) * Block; }
+
+		const T * Read(const Source & s, const T * const * in, T * result, T * stack) const
+		{
+			return s.reg >= 0 ? Address(s.reg, result, stack) : s.input >= 0 ? in[s.input] :
+				s.constant >= 0 ? constants.data() + size_t(s.constant) * Block : nullptr;
+		}
+
+		// Evaluates all blocks, out(begin) is where the result of block starting at begin goes or null for a block
+		// of the stack, which is then given to store(begin, len, block)
+		template<typename Out, typename Store>
+		void Run(const T * const * in, int n, const Out & out, const Store & store) const
+		{
+			// small programs keep the stack and pointers to input blocks in local arrays, which costs nothing per call
+			const int Local = 8;
+			T local[Local * Block];
+			const T * local_block[Local];
+			std::vector<T> heap;
+			std::vector<const T *> heap_block;
+			T * stack = local;
+			const T ** block = local_block;
+			if (registers + inputs > Local)
+			{
+				heap.resize(size_t(registers + inputs) * Block);
+				stack = heap.data();
+			}
+			if (inputs > Local)
+			{
+				heap_block.resize(inputs);
+				block = heap_block.data();
+			}
+			T * staged = Staged(inputs, stack);
+			for (int begin = 0; begin < n; begin += Block)
+			{
+				const int len = n - begin < Block ? n - begin : Block;
+				T * result = out(begin);
+				if (len == Block)
+					for (int k = 0; k < inputs; ++k)
+						block[k] = in[k] + begin;
+				else
+				{
+					// the last partial block runs on copies padded with the last value, which is as valid an operand
+					// for every operation as the value itself
+					for (int k = 0; k < inputs; ++k)
+					{
+						T * copy = Staged(k, stack);
+						std::copy(in[k] + begin, in[k] + n, copy);
+						std::fill(copy + len, copy + Block, in[k][n - 1]);
+						block[k] = copy;
+					}
+					result = nullptr;
+				}
+				T * dst = result ? result : staged;
+				for (const Instruction & ins : code)
+					ins.kernel(Address(ins.dst, dst, stack), Read(ins.src[0], block, dst, stack), Read(ins.src[1], block, dst, stack),
+						Read(ins.src[2], block, dst, stack), Read(ins.src[3], block, dst, stack));
+				if (!result)
+					store(begin, len, staged);
+			}
+		}
+
+	public:
+		explicit RuntimeProgram(const RuntimeExpr<T> & expr)
+		{
+			Compile(Simplify(expr.node).get(), 0);
+		}
+
+		// Number of input vectors the program reads
+		int Inputs() const { return inputs; }
+
+		// Number of passes over a block
+		int Instructions() const { return int(code.size()); }
+
+		// Evaluates program for n coordinates of contiguous inputs and writes result to out, which must not overlap inputs.
+		// The last instructions write straight to out.
+		void Evaluate(const T * const * in, int n, T * out) const
+		{
+			Run(in, n, [&](int begin) { return out + begin; },
+				[&](int begin, int len, const T * block) { std::copy(block, block + len, out + begin); });
+		}
+
+		template<typename Storage>
+		void Evaluate(const T * const * in, int n, const details::AssignableVectorView<Storage> & out) const
+		{
+			Run(in, n, [](int) { return static_cast<T*>(nullptr); }, [&](int begin, int len, const T * block)
+			{
+				for (int i = 0; i < len; ++i)
+					out.GetStorage()[begin + i] = block[i];
+			});
+		}
+	};
+}
@@ -1,6 +1,21 @@
 #include "VecView.h"
+#include "KMeans.h"
+#include "IvfIndex.h"
+#include "HnswIndex.h"
+#include "Compressed.h"
+#include "BitVector.h"
+#include "VectorStore.h"
+#include "RuntimeExpr.h"
 #include <iostream>
 #include <cassert>
+#include <vector>
+#include <thread>
+#include <cstdio>
+#include <algorithm>
+#include <limits>
+#include <cstdlib>
+#include <string>
+#include <ctime>
 
 namespace vevi
 {
@@ -157,6 +172,1226 @@ namespace vevi
 		assert(v[0] == 4 && v[1] == 6);
 	}
 
+	bool test_streaming_store()
+	{
+		float v1[37], v2[37], v3[38];
+		for (int i = 0; i < 37; ++i) { v1[i] = float(i); v2[i] = float(2 * i); }
+
+		Stream(AVec(v3, 37)) = Vec(v1) + Vec(v2);
+		for (int i = 0; i < 37; ++i) assert(v3[i] == 3 * i);
+
+		// unaligned destination
+		Stream(AVec(v3 + 1, 37)) = Vec(v1) - Vec(v2);
+		for (int i = 0; i < 37; ++i) assert(v3[i + 1] == -i);
+
+		// above threshold streaming is chosen automatically
+		std::vector<int> big(VEVI_STREAMING_THRESHOLD / sizeof(int) + 3);
+		AVec(big.data(), int(big.size())) = Num(7);
+		assert(big.front() == 7 && big.back() == 7);
+
+		return true;
+	}
+
+	bool test_multi_component()
+	{
+		float xyz[] = { 1, 2, 3, 4, 5, 6 };
+		float x[2], y[2], z[2];
+		float * soa[] = { x, y, z };
+
+		AVecNSoA<3>(soa, 2) = VecN<3>(xyz) + Num(1.f);
+		assert(x[0] == 2 && x[1] == 5 && y[0] == 3 && y[1] == 6 && z[0] == 4 && z[1] == 7);
+
+		float out[6];
+		AVecN<3>(out, 2) = VecNSoA<3>(soa) - VecN<3>(xyz, 2);
+		for (int i = 0; i < 6; ++i) assert(out[i] == 1);
+
+		float sy = Dot(Component(VecN<3>(xyz, 2), 1), Vec(y));
+		assert(sy == 36);
+		Component(AVecN<3>(out, 2), 2) = -Vec(z);
+		assert(out[2] == -4 && out[5] == -7 && out[4] == 1);
+
+		float back[6];
+		AosToSoa<3>(xyz, 2, soa);
+		assert(x[1] == 4 && y[0] == 2 && z[1] == 6);
+		SoaToAos<3>(soa, 2, back);
+		for (int i = 0; i < 6; ++i) assert(back[i] == xyz[i]);
+
+		return true;
+	}
+
+	bool test_batched_small_vectors()
+	{
+		float p[] = { 1, 0, 0, 0, 3, 4 };
+		float q[] = { 0, 1, 0, 1, 2, 2 };
+		float d[2], n[2], r[6];
+
+		AVec(d, 2) = BatchDot(VecN<3>(p, 2), VecN<3>(q));
+		assert(d[0] == 0 && d[1] == 14);
+
+		AVec(n, 2) = BatchNorm(VecN<3>(p, 2));
+		assert(n[0] == 1 && n[1] == 5);
+
+		AVecN<3>(r, 2) = BatchCross(VecN<3>(p, 2), VecN<3>(q));
+		assert(r[0] == 0 && r[1] == 0 && r[2] == 1);
+		assert(r[3] == -2 && r[4] == 4 && r[5] == -3);
+
+		float x[2], y[2], z[2];
+		float * soa[] = { x, y, z };
+		AVecNSoA<3>(soa, 2) = BatchNormalize(VecN<3>(p, 2) + VecN<3>(q));
+		assert(abs(x[0] * x[0] + y[0] * y[0] + z[0] * z[0] - 1) < 1e-6);
+		assert(abs(y[1] - 5 / sqrt(62.f)) < 1e-6);
+
+		return true;
+	}
+
+	bool test_cross_outer_rank1()
+	{
+		int v1[] = { 1, 2, 3 };
+		int v2[] = { 3, 4, 5 };
+		int v[3];
+
+		AVec(v, 3) = Cross(Vec(v1, 3), Vec(v2));
+		assert(v[0] == -2 && v[1] == 4 && v[2] == -2);
+		// both operands with dimention are checked, the result has it too
+		assert(Cross(Vec(v1), Vec(v2, 3)).Dim() == 3 && Cross(Vec(v1, 3), Vec(v2, 3)).Evaluate(1) == 4);
+		// the result may be written over an operand
+		int w[] = { 1, 2, 3 };
+		AVec(w, 3) = Cross(Vec(w, 3), Vec(v2));
+		assert(w[0] == -2 && w[1] == 4 && w[2] == -2);
+		AVec(w, 3) = Cross(Vec(v1, 3), Vec(w)) * Num(2);
+		assert(w[0] == -32 && w[1] == -8 && w[2] == 16);
+
+		int m[3 * 4] = { 0 };
+		AMat(m, 3, 2, 4) = Outer(Vec(v1, 3), Vec(v2, 2));
+		assert(m[0] == 3 && m[1] == 4 && m[4] == 6 && m[5] == 8 && m[8] == 9 && m[9] == 12 && m[2] == 0);
+
+		Rank1Update(AMat(m, 3, 2, 4), 2, Vec(v1), Vec(v2));
+		assert(m[0] == 9 && m[1] == 12 && m[8] == 27 && m[9] == 36 && m[2] == 0);
+		// columns in several tiles
+		std::vector<float> big(3 * 600, 1.f), y(600);
+		for (int j = 0; j < 600; ++j) y[j] = float(j);
+		Rank1Update(AMat(big.data(), 3, 600), 0.5f, Vec(v1), Vec(y.data()));
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 600; ++j)
+				assert(big[i * 600 + j] == 1 + 0.5f * v1[i] * j);
+
+		int c[3];
+		AVec(c, 3) = Mat(m, 3, 2, 4).Col(1);
+		assert(c[0] == 12 && c[1] == 24 && c[2] == 36);
+		AMat(m, 3, 2, 4).ARow(1) = Vec(v1);
+		assert(m[4] == 1 && m[5] == 2);
+
+		return true;
+	}
+
+	bool test_covariance_gram()
+	{
+		// 3 samples of dimention 2
+		float x[] = { 1, 2, 3, 6, 5, 4 };
+		double cov[4];
+		Covariance(Mat(x, 3, 2), AMat(cov, 2, 2));
+		assert(abs(cov[0] - 4) < 1e-9 && abs(cov[1] - 2) < 1e-9 && abs(cov[2] - 2) < 1e-9 && abs(cov[3] - 4) < 1e-9);
+
+		float g[9];
+		Gram(Mat(x, 3, 2), AMat(g, 3, 3));
+		assert(g[0] == 5 && g[1] == 15 && g[2] == 13 && g[3] == 15 && g[4] == 45 && g[8] == 41 && g[6] == 13);
+
+		// bigger random-like batch checked against direct two-pass computation
+		const int n = 1000, d = 70;
+		std::vector<float> big(n * d);
+		for (int i = 0; i < n * d; ++i) big[i] = float((i * 7919) % 101) / 10.f + 100.f;
+		std::vector<double> c(d * d);
+		Covariance(Mat(big.data(), n, d), AMat(c.data(), d, d));
+		std::vector<double> mean(d, 0.0);
+		for (int i = 0; i < n; ++i) for (int p = 0; p < d; ++p) mean[p] += big[i * d + p] / double(n);
+		for (int p = 0; p < d; p += 13)
+		{
+			for (int q = 0; q < d; q += 7)
+			{
+				double e = 0;
+				for (int i = 0; i < n; ++i) e += (big[i * d + p] - mean[p]) * (big[i * d + q] - mean[q]);
+				assert(abs(c[p * d + q] - e / (n - 1)) < 1e-6);
+			}
+		}
+
+		return true;
+	}
+
+	bool test_pairwise_distances()
+	{
+		float a[] = { 0, 0, 3, 4, 1, 0, 1, 1, 2, 2 };
+		float b[] = { 0, 0, 3, 0 };
+		float d[10];
+
+		PairwiseDistances(Mat(a, 5, 2), Mat(b, 2, 2), Metric::SquaredL2, AMat(d, 5, 2));
+		assert(d[0] == 0 && d[1] == 9 && d[2] == 25 && d[3] == 16 && d[4] == 1 && d[5] == 4 && d[9] == 5);
+
+		PairwiseDistances(Mat(a, 5, 2), Mat(b, 2, 2), Metric::L2, AMat(d, 5, 2));
+		assert(d[2] == 5 && d[3] == 4);
+
+		PairwiseDistances(Mat(a, 5, 2), Mat(b, 2, 2), Metric::Cosine, AMat(d, 5, 2));
+		assert(d[0] == 1 && abs(d[3] - 0.4f) < 1e-6 && abs(d[5]) < 1e-6 && abs(d[9] - (1 - 1 / sqrt(2.f))) < 1e-6);
+
+		// identical vectors are never negative distance apart
+		float c[] = { 0.1f, 0.2f, 0.3f, 0.1f, 0.2f, 0.3f };
+		PairwiseDistances(Mat(c, 2, 3), Mat(c, 2, 3), Metric::L2, AMat(d, 2, 2));
+		assert(d[0] >= 0 && d[1] >= 0 && d[1] < 1e-3);
+
+		return true;
+	}
+
+	bool test_kmeans()
+	{
+		// two well separated groups of 2d points
+		const int n = 200;
+		std::vector<float> x(n * 2);
+		for (int i = 0; i < n; ++i)
+		{
+			const float base = i % 2 ? 10.f : -10.f;
+			x[2 * i] = base + float(i % 7) / 7.f;
+			x[2 * i + 1] = base - float(i % 5) / 5.f;
+		}
+		std::vector<int> labels(n);
+		KMeansParams params(2);
+		auto c = KMeans(Mat(x.data(), n, 2), params, labels.data());
+
+		const int hi = c[0] > 0 ? 0 : 1;
+		assert(abs(c[2 * hi] - (10 + 3 / 7.f)) < 0.05 && abs(c[2 * hi + 1] - (10 - 2 / 5.f)) < 0.05);
+		assert(abs(c[2 * (1 - hi)] - (-10 + 3 / 7.f)) < 0.05);
+		for (int i = 0; i < n; ++i) assert(labels[i] == (i % 2 ? hi : 1 - hi));
+
+		// more clusters than distinct points must not break
+		float same[] = { 1, 1, 1, 1, 1, 1 };
+		KMeansParams many(3);
+		auto c2 = KMeans(Mat(same, 3, 2), many);
+		assert(c2[0] == 1 && c2[5] == 1);
+
+		// duplicated rows leave clusters empty, they are reseeded and the last iteration still returns labels
+		// of nearest centroids
+		float dup[] = { 0, 0, 0, 0, 0, 0, 0, 4, 9, 0, 9, 0 };
+		for (unsigned seed = 1; seed <= 20; ++seed)
+		{
+			KMeansParams reseed(4);
+			reseed.maxIterations = 1;
+			reseed.seed = seed;
+			int l[6];
+			auto c3 = KMeans(Mat(dup, 6, 2), reseed, l);
+			for (int i = 0; i < 6; ++i)
+			{
+				auto d2 = [&](int c) { return (dup[2 * i] - c3[2 * c]) * (dup[2 * i] - c3[2 * c]) + (dup[2 * i + 1] - c3[2 * c + 1]) * (dup[2 * i + 1] - c3[2 * c + 1]); };
+				assert(l[i] >= 0 && l[i] < 4);
+				for (int c = 0; c < 4; ++c) assert(d2(l[i]) <= d2(c));
+			}
+		}
+
+		return true;
+	}
+
+	bool test_ivf_index()
+	{
+		// grid of 2d points 20 x 20
+		const int n = 400;
+		std::vector<float> x(n * 2);
+		for (int i = 0; i < n; ++i) { x[2 * i] = float(i % 20); x[2 * i + 1] = float(i / 20); }
+
+		for (int int8 = 0; int8 < 2; ++int8)
+		{
+			IvfIndex<float> index(2, 8, Metric::SquaredL2, int8 != 0);
+			index.Train(Mat(x.data(), n, 2));
+			index.Add(Mat(x.data(), n, 2));
+			assert(index.Size() == n);
+
+			float q[] = { 3.1f, 4.2f, 15.f, 15.f };
+			int ids[6];
+			float d[6];
+			index.Search(Mat(q, 2, 2), 3, 8, ids, d);
+			assert(ids[0] == 4 * 20 + 3 && d[0] <= d[1] && d[1] <= d[2]);
+			assert(ids[3] == 15 * 20 + 15 && d[3] < 0.1);
+		}
+
+		// cosine on vectors with very different lengths: lists are chosen by direction, not by magnitude
+		{
+			const int m = 2000, dim = 8, nq = 50, k = 10;
+			std::vector<float> base(m * dim), queries(nq * dim);
+			std::mt19937 rng(7);
+			std::normal_distribution<float> gauss;
+			std::uniform_real_distribution<float> length(0.1f, 100.f);
+			for (int i = 0; i < m + nq; ++i)
+			{
+				float * v = i < m ? &base[i * dim] : &queries[(i - m) * dim];
+				const float len = length(rng);
+				for (int p = 0; p < dim; ++p) v[p] = gauss(rng) * len;
+			}
+			IvfIndex<float> index(dim, 16, Metric::Cosine);
+			index.Train(Mat(base.data(), m, dim));
+			index.Add(Mat(base.data(), m, dim));
+			std::vector<int> found(nq * k);
+			std::vector<float> fd(nq * k);
+			index.Search(Mat(queries.data(), nq, dim), k, 4, found.data(), fd.data());
+
+			int hits = 0;
+			for (int j = 0; j < nq; ++j)
+			{
+				const float * q = &queries[j * dim];
+				std::vector<std::pair<float, int>> all(m);
+				for (int i = 0; i < m; ++i)
+				{
+					const float * x = &base[i * dim];
+					all[i] = std::make_pair(-float(Dot(Vec(q, dim), Vec(x))) / std::sqrt(float(Dot(Vec(x, dim), Vec(x)))), i);
+				}
+				std::partial_sort(all.begin(), all.begin() + k, all.end());
+				for (int t = 0; t < k; ++t)
+					hits += int(std::count(found.begin() + j * k, found.begin() + (j + 1) * k, all[t].second));
+			}
+			assert(hits >= nq * k * 88 / 100);
+		}
+
+		// asking for more than stored
+		IvfIndex<float> small(2, 1);
+		small.Train(Mat(x.data(), 2, 2));
+		small.Add(Mat(x.data(), 2, 2));
+		int ids[3];
+		float d[3];
+		small.Search(Mat(x.data(), 1, 2), 3, 1, ids, d);
+		assert(ids[0] == 0 && d[0] == 0 && ids[1] == 1 && ids[2] == -1);
+
+		return true;
+	}
+
+	bool test_hnsw_index()
+	{
+		const int n = 600, dim = 8;
+		std::vector<float> x(n * dim);
+		unsigned r = 12345;
+		for (auto & v : x) { r = r * 1103515245 + 12345; v = float((r >> 8) % 1000) / 100.f; }
+
+		// ids are given in order of insertion, so results are compared by distance
+		auto nearest = [&](const float * q)
+		{
+			float bd = 1e30f;
+			for (int i = 0; i < n; ++i)
+			{
+				const float d = Dot(Vec(q, dim) - Vec(&x[i * dim]), Vec(q) - Vec(&x[i * dim]));
+				bd = d < bd ? d : bd;
+			}
+			return bd;
+		};
+
+		HnswIndex<float> index(dim, n, 8, 100);
+		// inserted concurrently from two threads while a third one searches
+		std::atomic<bool> done(false);
+		std::thread other([&]() { for (int i = 1; i < n; i += 2) index.Insert(&x[i * dim]); });
+		std::thread reader([&]()
+		{
+			int rid[3];
+			float rd[3];
+			while (!done)
+			{
+				index.Search(&x[0], 3, 20, rid, rd);
+				assert(rid[0] < 0 || rd[0] <= rd[1] || rid[1] < 0);
+			}
+		});
+		for (int i = 0; i < n; i += 2) index.Insert(&x[i * dim]);
+		other.join();
+		done = true;
+		reader.join();
+		assert(index.Size() == n);
+
+		int hits = 0;
+		float q[dim];
+		int ids[5];
+		float d[5];
+		for (int t = 0; t < 50; ++t)
+		{
+			for (int p = 0; p < dim; ++p) q[p] = x[(t * 11) * dim + p] + 0.01f;
+			index.Search(q, 5, 50, ids, d);
+			assert(d[0] <= d[1] && d[1] <= d[4]);
+			hits += d[0] == nearest(q);
+		}
+		assert(hits >= 45);
+
+		// file goes to the temporary directory and is removed before results are checked
+		const char * dir = std::getenv("TMPDIR");
+		dir = dir ? dir : std::getenv("TEMP");
+		const std::string path = std::string(dir ? dir : ".") + "/vevi_hnsw_test.bin";
+		const bool saved = index.Save(path.c_str());
+		HnswIndex<float> loaded;
+		const bool read = saved && loaded.Load(path.c_str());
+		std::remove(path.c_str());
+		assert(saved && read);
+		assert(loaded.Size() == n && loaded.Dim() == dim);
+		int ids2[5];
+		float d2[5];
+		index.Search(q, 5, 50, ids, d);
+		loaded.Search(q, 5, 50, ids2, d2);
+		for (int j = 0; j < 5; ++j) assert(ids[j] == ids2[j] && d[j] == d2[j]);
+
+		return true;
+	}
+
+	bool test_owned_vector()
+	{
+		int v1[] = { 1, 2, 3, 4 };
+		int v2[] = { 3, 4, 5, 6 };
+
+		// small vectors live inside the object
+		auto v = AVec<int>(2);
+		const char * self = reinterpret_cast<const char*>(&v);
+		assert(reinterpret_cast<const char*>(v.Data()) >= self && reinterpret_cast<const char*>(v.Data()) < self + sizeof(v));
+
+		// assignment takes dimention of expression
+		v = Vec(v1, 4) + Vec(v2);
+		assert(v.Dim() == 4 && v[3] == 10);
+
+		details::OwnedVector<int, 2> w(2);
+		w = Vec(v1, 4) - Vec(v2);
+		assert(w.Dim() == 4 && w.Capacity() == 4 && w[0] == -2);
+		const int * buf = w.Data();
+		w.Resize(3);
+		assert(w.Data() == buf && w.Capacity() == 4 && w[2] == -2);
+		w = Vec(v1, 2) + Vec(w.Data());
+		assert(w.Dim() == 2 && w.Data() == buf && w[1] == 0);
+		w.Resize(8);
+		assert(w.Dim() == 8 && w.Capacity() == 8 && w.Data() != buf && w[0] == -1 && w[1] == 0);
+		int v3[] = { 1, 1, 1, 1, 1, 1, 1, 1 };
+		w = Vec(v3) - Vec(w.Data(), 8);
+		assert(w[0] == 2 && w[1] == 1);
+
+		details::OwnedVector<int, 2> moved(std::move(w));
+		assert(moved.Dim() == 8 && w.Dim() == 0 && moved[0] == 2);
+		auto copy = v;
+		copy[0] = 100;
+		assert(v[0] == 4 && copy[1] == 6);
+
+		return true;
+	}
+
+	bool test_compound_assignment()
+	{
+		int v1[] = { 1, 2, 3 };
+		int v2[] = { 3, 4, 5 };
+		int v[3] = { 4, 6, 8 };
+
+		AVec(v, 3) += Num(2) * Vec(v1);
+		assert(v[0] == 6 && v[1] == 10 && v[2] == 14);
+		AVec(v, 3) -= Vec(v2);
+		assert(v[0] == 3 && v[1] == 6 && v[2] == 9);
+		AVec(v, 3) *= Vec(v1);
+		assert(v[0] == 3 && v[1] == 12 && v[2] == 27);
+		AVec(v, 3) /= 3;
+		assert(v[0] == 1 && v[1] == 4 && v[2] == 9);
+		AVec(v, 3) /= Vec(v1);
+		assert(v[0] == 1 && v[1] == 2 && v[2] == 3);
+
+		// destination may appear in expression
+		AVec(v, 3) += Vec(v) * Vec(v);
+		assert(v[0] == 2 && v[1] == 6 && v[2] == 12);
+
+		// strided and owned destinations
+		double m[] = { 1, 2, 3, 4, 5, 6 };
+		AVec(m, 3, 2) *= Num(2.0);
+		assert(m[0] == 2 && m[1] == 2 && m[2] == 6 && m[4] == 10);
+		AMat(m, 3, 2).ACol(1) -= Vec(m, 3, 2);
+		assert(m[1] == 0 && m[3] == -2 && m[5] == -4);
+
+		auto w = AVec<float>(3);
+		w = Vec(v1, 3) - Vec(v2);
+		w *= 0.5f;
+		w += Num(1.f);
+		assert(w[0] == 0.f && w[2] == 0.f);
+
+		return true;
+	}
+
+	bool test_broadcasting()
+	{
+		float m[] = { 1, 2, 3, 4, 5, 6 };
+		float mean[] = { 3, 4 };
+		float scale[] = { 1, 2, 4 };
+
+		// center columns
+		AMat(m, 3, 2) -= RowBroadcast(Vec(mean, 2));
+		assert(m[0] == -2 && m[1] == -2 && m[4] == 2 && m[5] == 2);
+
+		// scale rows, operands of any kind can be mixed
+		AMat(m, 3, 2) = Num(2.f) * Mat(m, 3, 2) / ColBroadcast(Vec(scale, 3)) + Num(1.f);
+		assert(m[0] == -3 && m[1] == -3 && m[2] == 1 && m[4] == 2 && m[5] == 2);
+
+		float out[6];
+		AMat(out, 2, 3) = RowBroadcast(Vec(scale)) - ColBroadcast(Vec(mean));
+		assert(out[0] == -2 && out[2] == 1 && out[3] == -3 && out[5] == 0);
+
+		// vector expressions are unaffected
+		float v[2];
+		AVec(v, 2) = Vec(mean) * Num(2.f) - Vec(scale, 2);
+		assert(v[0] == 5 && v[1] == 6);
+
+		return true;
+	}
+
+	bool test_row_col_reduce()
+	{
+		const int n = 3000, d = 37;
+		std::vector<float> m(n * d);
+		for (int i = 0; i < n * d; ++i) m[i] = float((i * 7919) % 101) / 10 - 5;
+
+		std::vector<double> rows(n), cols(d);
+		RowReduce(Mat(m.data(), n, d), Reduction::SquaredNorm, AVec(rows.data(), n));
+		for (int i = 0; i < n; i += 97)
+			assert(std::abs(rows[i] - float(Dot(Vec(&m[i * d], d), Vec(&m[i * d])))) < 1e-3);
+		RowReduce(Mat(m.data(), n, d), Reduction::Max, AVec(rows.data(), n));
+		assert(rows[5] == *std::max_element(&m[5 * d], &m[6 * d]));
+
+		ColReduce(Mat(m.data(), n, d), Reduction::Sum, AVec(cols.data(), d));
+		for (int j = 0; j < d; ++j)
+		{
+			double s = 0;
+			for (int i = 0; i < n; ++i) s += m[i * d + j];
+			assert(std::abs(cols[j] - s) < 1e-6 * n);
+		}
+		ColReduce(Mat(m.data(), n, d), Reduction::Min, AVec(cols.data(), d));
+		assert(cols[0] == -5);
+		// strided output, every other slot is left untouched
+		std::vector<double> strided(2 * d, -1.0);
+		ColReduce(Mat(m.data(), n, d), Reduction::Mean, AVec(strided.data(), d, 2));
+		for (int j = 0; j < d; ++j)
+		{
+			double s = 0;
+			for (int i = 0; i < n; ++i) s += m[i * d + j];
+			assert(std::abs(strided[2 * j] - s / n) < 1e-6 && strided[2 * j + 1] == -1.0);
+		}
+		ColReduce(Mat(m.data(), 0, d), Reduction::Sum, AVec(cols.data(), d));
+		assert(cols[0] == 0);
+
+		float sub[2];
+		ColReduce(Mat(m.data(), 2, 2, d), Reduction::Norm, AVec(sub, 2));
+		assert(std::abs(sub[0] - std::sqrt(m[0] * m[0] + m[d] * m[d])) < 1e-5);
+
+		return true;
+	}
+
+	template<typename T>
+	bool check_transpose(int rows, int cols)
+	{
+		std::vector<T> a(rows * cols), at(cols * rows), sq(rows * rows);
+		for (int i = 0; i < rows * cols; ++i) a[i] = T(i);
+		Transpose(Mat(a.data(), rows, cols), AMat(at.data(), cols, rows));
+		for (int i = 0; i < rows; ++i)
+			for (int j = 0; j < cols; ++j)
+				assert(at[j * rows + i] == a[i * cols + j]);
+
+		for (int i = 0; i < rows * rows; ++i) sq[i] = T(i);
+		Transpose(AMat(sq.data(), rows, rows));
+		for (int i = 0; i < rows; ++i)
+			for (int j = 0; j < rows; ++j)
+				assert(sq[j * rows + i] == T(i * rows + j));
+		return true;
+	}
+
+	bool test_transpose()
+	{
+		check_transpose<float>(3, 5);
+		check_transpose<float>(130, 67);
+		check_transpose<int>(257, 33);
+		check_transpose<double>(70, 45);
+
+		// views with leading dimention and converting types
+		float m[] = { 1, 2, 3, 0, 4, 5, 6, 0 };
+		double mt[] = { 0, 0, 0, 0, 0, 0 };
+		Transpose(Mat(m, 2, 3, 4), AMat(mt, 3, 2));
+		assert(mt[0] == 1 && mt[1] == 4 && mt[4] == 3 && mt[5] == 6);
+		Transpose(AMat(m, 2, 2, 4));
+		assert(m[1] == 4 && m[4] == 2 && m[3] == 0);
+
+		return true;
+	}
+
+	template<typename T>
+	bool check_convert(const std::vector<float> & src, Rounding rounding)
+	{
+		const int n = int(src.size());
+		std::vector<T> fast(n), slow(n);
+		AVec(fast.data(), n) = Convert<T>(Vec(src.data(), n), rounding);
+		// strided destination takes element by element path
+		AVec(slow.data(), n, 1) = Convert<T>(Vec(src.data(), n), rounding);
+		for (int i = 0; i < n; ++i)
+			assert(fast[i] == slow[i]);
+		return true;
+	}
+
+	bool test_convert()
+	{
+		std::vector<float> src;
+		for (int i = 0; i < 1000; ++i)
+			src.push_back(float(i - 500) * 7.3f + (i % 2 ? 0.5f : 0.25f));
+		src[3] = 2.5f;
+		src[4] = 1e10f;
+		src[5] = -1e10f;
+		src[6] = std::numeric_limits<float>::quiet_NaN();
+		for (Rounding r : { Rounding::Nearest, Rounding::Truncate, Rounding::Floor, Rounding::Ceil })
+		{
+			check_convert<std::uint8_t>(src, r);
+			check_convert<std::int8_t>(src, r);
+			check_convert<std::int16_t>(src, r);
+			check_convert<std::uint16_t>(src, r);
+			check_convert<int>(src, r);
+		}
+
+		std::uint8_t px[20];
+		AVec(px, 20) = Convert<std::uint8_t>(Vec(src.data(), 20) * Num(0.1f) + Num(100.f));
+		assert(px[3] == 100 && px[4] == 255 && px[5] == 0 && px[6] == 0);
+		std::int16_t s[2];
+		AVec(s, 2) = Convert<std::int16_t>(Vec(&src[3], 2), Rounding::Nearest);
+		assert(s[0] == 2 && s[1] == 32767);
+		AVec(s, 2) = Convert<std::int16_t>(Vec(&src[3], 2), Rounding::Ceil);
+		assert(s[0] == 3);
+
+		int big[] = { 300, -5, 70000 };
+		std::uint8_t b[3];
+		AVec(b, 3) = Convert<std::uint8_t>(Vec(big));
+		assert(b[0] == 255 && b[1] == 0 && b[2] == 255);
+		AVec(b, 3) = Convert<std::uint8_t>(Vec(big), Rounding::Nearest, false);
+		assert(b[0] == 44 && b[1] == 251);
+
+		return true;
+	}
+
+	template<typename T>
+	bool check_packed(const std::vector<T> & data, bool delta, bool sum = true)
+	{
+		const int n = int(data.size());
+		PackedVector<T> packed(data.data(), n, delta);
+		std::vector<T> out(n);
+		AVec(out.data(), n) = Vec(packed);
+		for (int i = 0; i < n; ++i)
+			assert(out[i] == data[i]);
+		if (sum)
+		{
+			long long s = 0;
+			for (int i = 0; i < n; ++i) s += data[i];
+			assert((long long)T(Sum(Vec(packed))) == s);
+			// Dot decodes blocks of packed operand on either side
+			assert((long long)Dot(Cast<long long>(Vec(packed)), Num(1LL)) == s);
+			assert((long long)Dot(Num(1LL), Cast<long long>(Vec(packed))) == s);
+		}
+		// expressions with packed leaves are assigned block by block
+		static_assert(details::BlockDecoded<decltype(Vec(packed) - Vec(data.data()))>::value, "block path");
+		std::fill(out.begin(), out.end(), T(1));
+		AVec(out.data(), n) = Vec(packed) - Vec(data.data()) + Vec(packed);
+		for (int i = 0; i < n; ++i)
+			assert(out[i] == data[i]);
+		// random access extracts single values
+		for (int i = n - 1; i >= 0; i -= 37)
+			assert(Vec(packed).Evaluate(i) == data[i]);
+		return true;
+	}
+
+	bool test_packed_vector()
+	{
+		std::vector<int> ids(1000);
+		for (int i = 0; i < 1000; ++i) ids[i] = (i * 7919) % 50 - 10;
+		check_packed(ids, false);
+		check_packed(ids, true);
+		PackedVector<int> small(ids.data(), 1000);
+		assert(small.Bytes() < 1000);
+
+		std::vector<unsigned> offsets(777);
+		for (int i = 0; i < 777; ++i) offsets[i] = 1000000u + 3u * i + (i % 3);
+		check_packed(offsets, true);
+		PackedVector<unsigned> sorted(offsets.data(), 777, true);
+		assert(sorted.Bytes() < 777);
+
+		std::vector<int> extreme(300);
+		for (int i = 0; i < 300; ++i) extreme[i] = i % 2 ? std::numeric_limits<int>::max() : std::numeric_limits<int>::min() + i;
+		check_packed(extreme, false, false);
+		check_packed(extreme, true, false);
+		check_packed(std::vector<short>(130, -3), true);
+		check_packed(std::vector<int>(), false);
+
+		std::vector<int> dense(1000, 1), res(1000);
+		AVec(res.data(), 1000) = Vec(small) + Vec(dense.data());
+		assert(res[999] == ids[999] + 1);
+		assert(Dot(Vec(small), Vec(dense.data())) == Sum(Vec(small)));
+
+		// views are stateless, so threads may evaluate one expression at once
+		for (int delta = 0; delta < 2; ++delta)
+		{
+			std::vector<int> many(delta ? 1 << 18 : 1 << 20);
+			long long expected = 0;
+			for (size_t i = 0; i < many.size(); ++i)
+			{
+				many[i] = delta ? int(3 * i + i % 5) : int((i * 2654435761u) % 1000);
+				expected += many[i];
+			}
+			PackedVector<int> shared(many.data(), int(many.size()), delta != 0);
+			auto plus = [](long long a, long long b) { return a + b; };
+			for (int run = 0; run < 5; ++run)
+				assert((long long)ParallelReduce(plus, 0LL, Cast<long long>(Vec(shared))) == expected);
+		}
+
+		return true;
+	}
+
+	bool test_rle_vector()
+	{
+		std::vector<float> data(1000, 0.f), dense(1000);
+		for (int i = 300; i < 310; ++i) data[i] = 2.f;
+		for (int i = 700; i < 1000; ++i) data[i] = -1.f;
+		for (int i = 0; i < 1000; ++i) dense[i] = float(i % 7);
+
+		RleVector<float> rle(data.data(), 1000);
+		assert(rle.Runs() == 4 && rle.Size() == 1000);
+		std::vector<float> out(1000);
+		AVec(out.data(), 1000) = Vec(rle) * Num(3.f);
+		for (int i = 0; i < 1000; ++i)
+			assert(out[i] == 3 * data[i]);
+		// random access
+		assert(Vec(rle).Evaluate(305) == 2.f && Vec(rle).Evaluate(0) == 0.f && Vec(rle).Evaluate(999) == -1.f);
+
+		const float dot = Dot(Vec(data.data(), 1000), Vec(dense.data()));
+		assert(float(Dot(Vec(rle), Vec(dense.data()))) == dot);
+		assert(float(Dot(Vec(dense.data()), Vec(rle))) == dot);
+		assert(float(Sum(Vec(rle))) == -280.f);
+
+		RleVector<int> mask;
+		mask.Append(0, 500);
+		mask.Append(1, 200);
+		mask.Append(1, 100);
+		mask.Append(0, 200);
+		assert(mask.Runs() == 3 && mask.Size() == 1000);
+		assert(float(Dot(Vec(rle), Vec(mask))) == -100.f);
+		assert(float(Dot(Vec(mask), Vec(rle))) == -100.f);
+
+		// one view shared by threads of ParallelReduce, short runs so that every block crosses many of them
+		std::vector<int> steps(1 << 20);
+		long long expected = 0;
+		for (int i = 0; i < int(steps.size()); ++i)
+		{
+			steps[i] = (i / 3) % 11;
+			expected += steps[i];
+		}
+		RleVector<int> shared(steps.data(), int(steps.size()));
+		auto plus = [](long long a, long long b) { return a + b; };
+		for (int run = 0; run < 5; ++run)
+			assert((long long)ParallelReduce(plus, 0LL, Cast<long long>(Vec(shared))) == expected);
+		std::vector<int> decoded(steps.size());
+		AVec(decoded.data(), int(decoded.size())) = Vec(shared) + Vec(steps.data()) - Vec(shared);
+		assert(decoded == steps);
+
+		return true;
+	}
+
+	bool test_bit_vector()
+	{
+		const int n = 64 * 200000 + 37;
+		BitVector a(n), b(n);
+		long long both = 0, diff = 0, any = 0;
+		for (int i = 0; i < n; ++i)
+		{
+			const bool x = (i * 2654435761u) % 3 == 0, y = (i * 40503u) % 5 < 2;
+			a.Set(i, x);
+			b.Set(i, y);
+			both += x && y;
+			diff += x != y;
+			any += x || y;
+		}
+		assert(Dot(Vec(a), Vec(b)) == both);
+		assert(Hamming(Vec(a), Vec(b)) == diff);
+		assert(std::abs(Jaccard(Vec(a), Vec(b)) - double(both) / double(any)) < 1e-12);
+		assert(Hamming(Vec(a), Vec(a)) == 0 && Dot(Vec(a), Vec(a)) == a.Count());
+
+		float embedding[] = { 0.5f, -1.f, 2.f, 0.f, 3.f };
+		BitVector e(embedding, 5);
+		assert(e.Get(0) && !e.Get(1) && e.Get(2) && !e.Get(3) && e.Count() == 3);
+		int weights[] = { 1, 10, 100, 1000, 10000 };
+		assert(Dot(Vec(e), Vec(weights)) == 10101);
+		int dense[5];
+		AVec(dense, 5) = Vec(e) + Vec(weights);
+		assert(dense[0] == 2 && dense[1] == 10);
+		assert(Jaccard(Vec(BitVector(5)), Vec(BitVector(5))) == 1.0);
+
+		return true;
+	}
+
+	bool test_vector_store()
+	{
+		const int dim = 16, n = 3000;
+		VectorStore<float> store(dim, n, 256);
+		{
+			auto snap = store.Read();
+			assert(snap.Chunks() == 12 && snap.Chunk(11).Rows() == 184 && snap.Row(2999)[15] == 0);
+		}
+
+		// Writer publishes pairs of vectors in different chunks filled with the same version number,
+		// readers must never see torn vectors or a pair from different versions
+		std::atomic<bool> done(false);
+		std::atomic<int> bad(0);
+		std::vector<std::thread> readers;
+		for (int t = 0; t < 3; ++t)
+			readers.emplace_back([&]()
+			{
+				std::vector<float> ones(dim, 1.f);
+				while (!done)
+				{
+					auto snap = store.Read();
+					const float v = snap.Row(7)[0];
+					if (float(Dot(snap.Vec(7), Vec(ones.data()))) != v * dim || snap.Row(2500)[dim - 1] != v)
+						++bad;
+				}
+			});
+		std::vector<float> values(2 * dim);
+		const int ids[] = { 7, 2500 };
+		for (int version = 1; version <= 2000; ++version)
+		{
+			for (int k = 0; k < 2 * dim; ++k) values[k] = float(version);
+			store.Update(ids, values.data(), 2);
+		}
+		done = true;
+		for (auto & r : readers) r.join();
+		assert(bad == 0);
+
+		auto snap = store.Read();
+		assert(snap.Row(7)[3] == 2000.f && snap.Row(2500)[0] == 2000.f && snap.Row(8)[0] == 0.f);
+		store.Update(8, values.data());
+		// the old snapshot does not change
+		assert(snap.Row(8)[0] == 0.f && store.Read().Row(8)[0] == 2000.f);
+
+		// more snapshots than one group of reader slots, old ones keep their chunks through updates
+		std::vector<VectorStore<float>::Snapshot> held;
+		for (int k = 0; k < 200; ++k)
+		{
+			held.push_back(store.Read());
+			for (int i = 0; i < dim; ++i) values[i] = float(10000 + k);
+			store.Update(9, values.data());
+		}
+		for (int k = 0; k < 200; ++k)
+			assert(held[k].Row(9)[0] == (k ? float(10000 + k - 1) : 0.f));
+		held.clear();
+		assert(store.Read().Row(9)[dim - 1] == 10199.f);
+
+		return true;
+	}
+
+	bool test_append_only_store()
+	{
+		const int dim = 8, n = 5000;
+		AppendOnlyStore<int> store(dim, 16);
+		std::vector<int> v(dim);
+		v[0] = -1;
+		store.Append(v.data());
+		const int * first = store.Row(0);
+
+		// Reader scans segment by segment while the writer appends
+		std::atomic<bool> done(false);
+		std::atomic<int> bad(0);
+		std::thread reader([&]()
+		{
+			while (!done)
+			{
+				const int size = store.Size();
+				int rows = 0;
+				for (int k = 0; k < store.Segments(size); ++k)
+				{
+					const auto seg = store.Segment(k, size);
+					for (int i = 0; i < seg.Rows(); ++i)
+						if (i + store.SegmentBegin(k) > 0 && seg.RowPtr(i)[dim - 1] != i + store.SegmentBegin(k))
+							++bad;
+					rows += seg.Rows();
+				}
+				if (rows != size) ++bad;
+			}
+		});
+		for (int i = 1; i < n; ++i)
+		{
+			for (int p = 0; p < dim; ++p) v[p] = i;
+			assert(store.Append(v.data()) == i);
+		}
+		done = true;
+		reader.join();
+		assert(bad == 0);
+
+		assert(store.Size() == n && store.Row(0) == first && first[0] == -1);
+		assert(store.Row(4321)[3] == 4321 && store.Row(16)[0] == 16 && store.Row(15)[0] == 15);
+		assert(store.Segments(n) == 9 && store.Segment(8, n).Rows() == n - store.SegmentBegin(8));
+		std::vector<int> ones(dim, 1);
+		assert(Dot(store.Vec(100), Vec(ones.data())) == 100 * dim);
+
+		return true;
+	}
+
+	struct Bucket
+	{
+		int buckets;
+		int operator()(int id, int seed) const { return int((unsigned(id) * 2654435761u + unsigned(seed)) % unsigned(buckets)); }
+	};
+
+	bool test_map()
+	{
+		float x[] = { -2.f, -0.5f, 0.f, 1.f, 3.f };
+		float y[5];
+
+		// piecewise linear activation
+		AVec(y, 5) = Map([](float v) { return v < -1 ? -1 : (v > 1 ? 1 + 0.1f * (v - 1) : v); }, Vec(x));
+		assert(y[0] == -1 && y[1] == -0.5f && y[3] == 1 && std::abs(y[4] - 1.2f) < 1e-6);
+
+		// fused with other operations, dimention comes from any argument, several arguments and Num
+		AVec(y, 5) = Num(1.f) + Map([](float a, float b, float c) { return a * b + c; }, Vec(x), Vec(x, 5), Num(2.f));
+		assert(y[0] == 7 && y[2] == 3 && y[4] == 12);
+		assert(Map([](float a) { return a * a; }, Vec(x, 5)).Dim() == 5);
+		assert(float(Dot(Map([](float a) { return a > 0 ? a : 0; }, Vec(x, 5)), Vec(x))) == 10);
+
+		// functor with state and different result type
+		int ids[] = { 1, 2, 3, 1000001 };
+		int bucket[4];
+		Bucket hash = { 16 };
+		AVec(bucket, 4) = Map(hash, Vec(ids), Num(7));
+		for (int i = 0; i < 4; ++i)
+			assert(bucket[i] == hash(ids[i], 7) && bucket[i] >= 0 && bucket[i] < 16);
+
+		return true;
+	}
+
+	bool test_reduce()
+	{
+		const int n = 100000;
+		std::vector<float> x(n), w(n);
+		std::vector<int> k(n);
+		for (int i = 0; i < n; ++i)
+		{
+			x[i] = float((i * 37) % 101) - 50;
+			w[i] = float(i % 3);
+			k[i] = (i * 7919) % 1000 - 500;
+		}
+
+		// weighted L1 norm
+		double l1 = 0;
+		for (int i = 0; i < n; ++i) l1 += w[i] * std::abs(x[i]);
+		auto weighted = [](float a, float b) { return double(a) * std::abs(b); };
+		assert(double(Reduce(Plus(), 0.0, Map(weighted, Vec(w.data(), n), Vec(x.data())))) == l1);
+		assert(double(ParallelReduce(Plus(), 0.0, Map(weighted, Vec(w.data(), n), Vec(x.data())))) == l1);
+
+		// clipped sum, minimum, maximum and largest magnitude
+		long long expected = 0;
+		int mn = k[0], mx = k[0], mag = 0;
+		for (int i = 0; i < n; ++i)
+		{
+			expected += k[i] > 100 ? 100 : (k[i] < -100 ? -100 : k[i]);
+			mn = k[i] < mn ? k[i] : mn;
+			mx = k[i] > mx ? k[i] : mx;
+			mag = std::abs(k[i]) > mag ? std::abs(k[i]) : mag;
+		}
+		// combine has to be associative, clipping is done on single coordinates by Map
+		auto clip = [](int v) { return v > 100 ? 100 : (v < -100 ? -100 : v); };
+		assert(int(ParallelReduce(Plus(), 0, Map(clip, Vec(k.data(), n)))) == expected);
+		assert(int(ParallelReduce(Minimum(), std::numeric_limits<int>::max(), Vec(k.data(), n))) == mn);
+		assert(int(ParallelReduce(Maximum(), std::numeric_limits<int>::min(), Vec(k.data(), n))) == mx);
+		assert(int(Reduce(Maximum(), std::numeric_limits<int>::min(), Vec(k.data(), 0))) == std::numeric_limits<int>::min());
+		// a lambda works as well as long as it is associative
+		auto largest = [](int a, int b) { return std::abs(a) < std::abs(b) ? std::abs(b) : std::abs(a); };
+		assert(int(ParallelReduce(largest, 0, Vec(k.data(), n))) == mag);
+		assert(int(Reduce(largest, 0, Vec(k.data(), 3))) == largest(largest(k[0], k[1]), k[2]));
+
+		// Dot and Sum are built on the same reduction
+		int v1[] = { 1, 2, 3, 4, 5 };
+		assert(Dot(Vec(v1, 5), Vec(v1)) == 55 && Sum(Vec(v1, 5)) == 15);
+		// 16 bit sums, which GCC 12 miscompiled with four accumulators
+		std::vector<short> s(128, -3);
+		assert(short(Sum(Vec(s.data(), 128))) == -384);
+
+		return true;
+	}
+
+	bool test_runtime_expr()
+	{
+		const int n = 1000;
+		std::vector<float> a(n), b(n), out(n), ref(n), strided(2 * n);
+		for (int i = 0; i < n; ++i)
+		{
+			a[i] = float(i % 17) - 8;
+			b[i] = float(i % 5) + 1;
+		}
+		const float * inputs[] = { a.data(), b.data() };
+
+		// same pipeline composed at runtime and at compile time
+		auto x = RuntimeExpr<float>::Input(0), y = RuntimeExpr<float>::Input(1);
+		RuntimeProgram<float> program((x - y) * (x + y) / y + -x * RuntimeExpr<float>::Const(0.5f));
+		assert(program.Inputs() == 2);
+		program.Evaluate(inputs, n, out.data());
+		AVec(ref.data(), n) = (Vec(a.data(), n) - Vec(b.data())) * (Vec(a.data()) + Vec(b.data())) / Vec(b.data()) + -Vec(a.data()) * Num(0.5f);
+		for (int i = 0; i < n; ++i)
+			assert(std::abs(out[i] - ref[i]) < 1e-4f);
+
+		// ops chosen by name, i.e. from a config, written to a strided view
+		RuntimeOp ops[] = { RuntimeOp::Max, RuntimeOp::Sub };
+		RuntimeExpr<float> e = RuntimeExpr<float>::Unary(RuntimeOp::Abs, y);
+		for (RuntimeOp op : ops)
+			e = RuntimeExpr<float>::Binary(op, e, RuntimeExpr<float>::Unary(RuntimeOp::Sqrt, Abs(x)));
+		RuntimeProgram<float>(e).Evaluate(inputs, n, AVec(strided.data(), n, 2));
+		for (int i = 0; i < n; ++i)
+		{
+			const float s = std::sqrt(std::abs(a[i]));
+			assert(std::abs(strided[2 * i] - ((b[i] > s ? b[i] : s) - s)) < 1e-5f);
+		}
+
+		// input shorter than a block
+		RuntimeProgram<float>(Min(x, RuntimeExpr<float>::Const(0))).Evaluate(inputs, 3, out.data());
+		assert(out[0] == -8 && out[1] == -7 && out[2] == -6);
+
+		// every op of its arity, with operands in every place a kernel reads them from
+		typedef RuntimeExpr<float> E;
+		const RuntimeOp binary[] = { RuntimeOp::Add, RuntimeOp::Sub, RuntimeOp::Mul, RuntimeOp::Div, RuntimeOp::Min, RuntimeOp::Max };
+		const RuntimeOp unary[] = { RuntimeOp::Neg, RuntimeOp::Abs, RuntimeOp::Sqrt };
+		auto apply = [](RuntimeOp op, float p, float q)
+		{
+			switch (op)
+			{
+			case RuntimeOp::Add: return p + q;
+			case RuntimeOp::Sub: return p - q;
+			case RuntimeOp::Mul: return p * q;
+			case RuntimeOp::Div: return p / q;
+			case RuntimeOp::Min: return q < p ? q : p;
+			case RuntimeOp::Max: return p < q ? q : p;
+			case RuntimeOp::Neg: return -p;
+			case RuntimeOp::Abs: return std::abs(p);
+			default: return std::sqrt(p);
+			}
+		};
+		const E c = E::Const(2.f), sum = x * x + y;
+		for (RuntimeOp op : binary)
+			for (RuntimeOp post : unary)
+			{
+				// leaf and leaf, constant and leaf, two constants, stack and leaf, leaf and stack, stack and stack,
+				// all followed by a unary operation that is fused into them
+				const E operands[][2] = { { x, y }, { c, y }, { c, c }, { sum, y }, { x, sum }, { sum, sum * c } };
+				for (const auto & pair : operands)
+				{
+					RuntimeProgram<float>(E::Unary(post, E::Unary(RuntimeOp::Abs, E::Binary(op, pair[0], pair[1])))).Evaluate(inputs, 300, out.data());
+					std::vector<float> second(300);
+					RuntimeProgram<float>(pair[0]).Evaluate(inputs, 300, ref.data());
+					RuntimeProgram<float>(pair[1]).Evaluate(inputs, 300, second.data());
+					for (int i = 0; i < 300; ++i)
+						assert(std::abs(out[i] - apply(post, std::abs(apply(op, ref[i], second[i])), 0)) <= 1e-5f * (1 + std::abs(out[i])));
+				}
+			}
+
+		// chains of operations are single instructions, negations are folded into them
+		assert(program.Instructions() == 2);
+		const E fused[] = { x * y + c, c - x * y, (x - y) / (x + y), x * y + y * c, -x * c, x + -y, -x - y, -(-x), -x * -y };
+		for (const E & f : fused)
+		{
+			RuntimeProgram<float> p(f);
+			assert(p.Instructions() == 1);
+			p.Evaluate(inputs, n, out.data());
+			for (int i = 0; i < n; ++i)
+			{
+				const float r[] = { a[i] * b[i] + 2, 2 - a[i] * b[i], (a[i] - b[i]) / (a[i] + b[i]), a[i] * b[i] + b[i] * 2,
+					-a[i] * 2, a[i] - b[i], -a[i] - b[i], a[i], a[i] * b[i] };
+				assert(out[i] == r[&f - fused] || std::abs(out[i] - r[&f - fused]) <= 1e-5f * std::abs(r[&f - fused]));
+			}
+		}
+
+		// integers in a partial block: padding is the last value, so a division doesn't see zeros
+		std::vector<int> p(n), q(n, 3), res(n);
+		for (int i = 0; i < n; ++i)
+			p[i] = i - 500;
+		const int * int_inputs[] = { p.data(), q.data() };
+		typedef RuntimeExpr<int> I;
+		RuntimeProgram<int>(I::Input(0) / I::Input(1) - I::Const(1)).Evaluate(int_inputs, 5, res.data());
+		for (int i = 0; i < 5; ++i)
+			assert(res[i] == p[i] / 3 - 1);
+
+		// more inputs and registers than the local stack holds
+		std::vector<const int *> many(12);
+		I deep = I::Input(0);
+		for (int k = 0; k < 12; ++k)
+		{
+			many[k] = k % 3 ? p.data() : q.data();
+			deep = k % 3 ? I::Input(k) - deep : Abs(deep * I::Input(k) + I::Input(k));
+		}
+		RuntimeProgram<int> wide(deep);
+		assert(wide.Inputs() == 12);
+		wide.Evaluate(many.data(), n, res.data());
+		for (int i = 0; i < n; ++i)
+		{
+			int r = many[0][i];
+			for (int k = 0; k < 12; ++k)
+				r = k % 3 ? many[k][i] - r : std::abs(r * many[k][i] + many[k][i]);
+			assert(res[i] == r);
+		}
+
+		return true;
+	}
+
+	bool test_simplification()
+	{
+		int v1[] = { 1, 2, 3 };
+		float f[] = { 0.5f, 1.5f, 2.5f };
+		int v[3];
+		using IntView = details::VectorView<details::storages::ArrayPtr<const int*>>;
+
+		// numbers are folded
+		static_assert(std::is_same<decltype(Num(2) * Num(3) - Num(1)), details::NumberView<int>>::value, "folded");
+		assert(int(Num(2) * Num(3) - Num(1)) == 5 && int(-Num(4) / Num(2)) == -2);
+		AVec(v, 3) = Num(2) * Num(3) + Vec(v1);
+		assert(v[0] == 7 && v[2] == 9);
+
+		// neutral elements, double negation and casts to the same type are removed
+		static_assert(std::is_same<decltype(Zero<int>() + Vec(v1, 3)), const IntView &>::value, "zero");
+		static_assert(std::is_same<decltype(Vec(v1, 3) - Zero<int>()), const IntView &>::value, "zero");
+		static_assert(std::is_same<decltype(One<int>() * Vec(v1, 3)), const IntView &>::value, "one");
+		static_assert(std::is_same<decltype(Vec(v1, 3) / One<int>()), const IntView &>::value, "one");
+		static_assert(std::is_same<decltype(-(-Vec(v1, 3))), const IntView &>::value, "negation");
+		static_assert(std::is_same<decltype(Cast<int>(Vec(v1, 3))), const IntView &>::value, "cast");
+		static_assert(std::is_same<decltype(Zero<int>() + Zero<int>()), details::ZeroView<int>>::value, "zero");
+		AVec(v, 3) = Zero<int>() + One<int>() * -(-Cast<int>(Vec(v1, 3))) * One<int>() + Zero<int>();
+		assert(v[0] == 1 && v[1] == 2 && v[2] == 3);
+		assert(Dot(Zero<int>() + Vec(v1, 3), Vec(v1) / One<int>()) == 14);
+
+		// operations changing the type are kept
+		static_assert(!std::is_same<decltype(Zero<float>() + Vec(v1, 3)), const IntView &>::value, "promotion");
+		float g[3];
+		AVec(g, 3) = Zero<float>() + Vec(v1, 3) * One<float>();
+		assert(g[0] == 1 && g[2] == 3);
+		AVec(v, 3) = Cast<int>(Vec(f, 3));
+		assert(v[0] == 0 && v[2] == 2);
+
+		// neutral elements evaluate to numbers elsewhere
+		AVec(g, 3) = One<float>() - Vec(f, 3);
+		assert(g[0] == 0.5f && g[2] == -1.5f);
+
+		return true;
+	}
+
+	bool test_copy_fill()
+	{
+		float src[41], dst[41];
+		for (int i = 0; i < 41; ++i) src[i] = float(i) - 20;
+
+		// plain copies, with and without dimention of source, and overlapping ranges
+		AVec(dst, 41) = Vec(src, 41);
+		for (int i = 0; i < 41; ++i) assert(dst[i] == src[i]);
+		AVec(dst, 5) = Vec(src + 30);
+		assert(dst[0] == 10 && dst[4] == 14 && dst[5] == -15);
+		AVec(dst + 1, 40) = Vec(dst, 40);
+		assert(dst[1] == 10 && dst[5] == 14 && dst[40] == 19);
+		Stream(AVec(dst + 1, 37)) = Vec(src, 37);
+		for (int i = 0; i < 37; ++i) assert(dst[i + 1] == src[i]);
+
+		// strided gather
+		AVec(dst, 13) = Vec(src, 13, 3);
+		for (int i = 0; i < 13; ++i) assert(dst[i] == src[3 * i]);
+		AVec(dst, 7) = Vec(src + 40, 7, -2);
+		for (int i = 0; i < 7; ++i) assert(dst[i] == src[40 - 2 * i]);
+
+		// fills, zero is written by memset, -0.f is not all zero bits
+		AVec(dst, 41) = Num(2.5f);
+		assert(dst[0] == 2.5f && dst[40] == 2.5f);
+		AVec(dst, 41) = Num(0);
+		assert(dst[0] == 0 && dst[40] == 0);
+		AVec(dst, 3) = Num(-0.f);
+		assert(std::signbit(dst[0]) && std::signbit(dst[2]) && !std::signbit(dst[3]));
+		AVec(dst, 41) = Zero<float>();
+		assert(dst[0] == 0 && !std::signbit(dst[0]));
+
+		// above threshold copies are streamed
+		std::vector<int> big(VEVI_STREAMING_THRESHOLD / sizeof(int) + 5), copy(big.size());
+		for (size_t i = 0; i < big.size(); ++i) big[i] = int(i);
+		AVec(copy.data() + 1, int(big.size()) - 1) = Vec(big.data());
+		assert(copy[1] == 0 && copy.back() == int(big.size()) - 2);
+		AVec(copy.data(), int(big.size())) = Num(0);
+		assert(copy[1] == 0 && copy.back() == 0);
+
+		// owned vectors take the same paths
+		auto owned = AVec<float>(41);
+		owned = Vec(src, 41);
+		assert(owned[40] == 20);
+
+		return true;
+	}
+
+	// Seconds of processor time taken by f, which other processes do not inflate
+	template<typename F>
+	double time_once(const F & f)
+	{
+		const std::clock_t start = std::clock();
+		f();
+		return double(std::clock() - start) / CLOCKS_PER_SEC;
+	}
+
+	// Best of several runs of f
+	template<typename F>
+	double best_time(const F & f)
+	{
+		double best = 1e30;
+		for (int run = 0; run < 7; ++run)
+			best = std::min(best, time_once(f));
+		return best;
+	}
+
+	// Ratio of best times of f and g, runs alternate so that both see the same state of the machine
+	template<typename F, typename G>
+	double best_ratio(const F & f, const G & g)
+	{
+		double best_f = 1e30, best_g = 1e30;
+		for (int run = 0; run < 7; ++run)
+		{
+			best_f = std::min(best_f, time_once(f));
+			best_g = std::min(best_g, time_once(g));
+		}
+		return best_f / best_g;
+	}
+
+	void benchmarks()
+	{
+		const int n = 1 << 14, reps = 1000;
+		std::vector<float> a(n), b(n), out(n);
+		for (int i = 0; i < n; ++i)
+		{
+			a[i] = float(i % 17) - 8;
+			b[i] = float(i % 5) + 1;
+		}
+		const float * inputs[] = { a.data(), b.data() };
+
+		// the pipeline of test_runtime_expr composed at runtime and at compile time
+		auto x = RuntimeExpr<float>::Input(0), y = RuntimeExpr<float>::Input(1);
+		RuntimeProgram<float> program((x - y) * (x + y) / y + -x * RuntimeExpr<float>::Const(0.5f));
+		const double runtime = best_ratio([&]()
+		{
+			for (int r = 0; r < reps; ++r)
+				program.Evaluate(inputs, n, out.data());
+		}, [&]()
+		{
+			for (int r = 0; r < reps; ++r)
+				AVec(out.data(), n) = (Vec(a.data(), n) - Vec(b.data())) * (Vec(a.data()) + Vec(b.data())) / Vec(b.data()) + -Vec(a.data()) * Num(0.5f);
+		});
+		printf("RuntimeProgram / expression template: %.2f\n", runtime);
+
+		// packed operands against the same values in memory, arrays are far beyond caches
+		const int m = 1 << 23;
+		std::vector<unsigned> small(m), sums(m), other(m), res(m);
+		unsigned running = 0;
+		for (int i = 0; i < m; ++i)
+		{
+			small[i] = (i * 2654435761u) % 1000;
+			running += small[i] % 5;
+			sums[i] = running;
+			other[i] = i % 7;
+		}
+		for (int delta = 0; delta < 2; ++delta)
+		{
+			const unsigned * values = delta ? sums.data() : small.data();
+			const PackedVector<unsigned> packed(values, m, delta != 0);
+			volatile unsigned sink = 0;
+			const double assign = best_ratio([&]() { AVec(res.data(), m) = Vec(packed) + Vec(other.data()); },
+				[&]() { AVec(res.data(), m) = Vec(values, m) + Vec(other.data()); });
+			const double dot = best_ratio([&]() { sink = Dot(Vec(packed), Vec(other.data())); },
+				[&]() { sink = Dot(Vec(values, m), Vec(other.data())); });
+			const double sum = best_ratio([&]() { sink = Sum(Vec(packed)); }, [&]() { sink = Sum(Vec(values, m)); });
+			printf("Packed%s / dense, %.2f of bytes: assign %.2f, Dot %.2f, Sum %.2f\n", delta ? " delta" : "",
+				double(packed.Bytes()) / (sizeof(unsigned) * m), assign, dot, sum);
+		}
+	}
+
 	bool tests()
 	{
 		compile_usage();
@@ -171,6 +1406,31 @@ namespace vevi
 		test_cast();
 		test_stride();
 		test_owned_array();
+		test_streaming_store();
+		test_multi_component();
+		test_batched_small_vectors();
+		test_cross_outer_rank1();
+		test_covariance_gram();
+		test_pairwise_distances();
+		test_kmeans();
+		test_ivf_index();
+		test_hnsw_index();
+		test_owned_vector();
+		test_compound_assignment();
+		test_broadcasting();
+		test_row_col_reduce();
+		test_transpose();
+		test_convert();
+		test_packed_vector();
+		test_rle_vector();
+		test_bit_vector();
+		test_vector_store();
+		test_append_only_store();
+		test_map();
+		test_reduce();
+		test_runtime_expr();
+		test_simplification();
+		test_copy_fill();
 		//std::cout << vevi::Operations::HasMemberDim<Operations::NumberView<int>>::value;
 		//std::cout << vevi::Operations::HasMemberDim<Operations::VectorView<int>>::value;
 		return true;
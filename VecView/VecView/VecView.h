@@ -6,6 +6,7 @@
 //
 // This library does not provide implementation of Vector type with storage. 
 // Instead it operates on Vector Views that require storage interface for construction, and calls its operator [] to access elements of vector.
+// The only exception is small owning vector AVec<T>(dim) to keep results of expressions, it is built on the same storage interface.
 //
 // Arguments of operations can be const views of vectors.
 // There is a special assignable view results of computation can be assigned to.
@@ -46,26 +47,158 @@
 // int dotprod2 = Dot(Vec(v1,3),Vec(v2)); // 26
 // int dotprod3 = Dot(Vec(v1) + Vec(v1), Vec(v2,3)); // equivalent to Dot({2,4,6},{3,4,5}) = 52
 // int dotprod4 = Dot(Vec(v1),Vec(v2)); // compile time error, no way to infer dimentions of vectors
+// int sum = Sum(Vec(v1,3)); // 6
+// int largest = Reduce(Maximum(), INT_MIN, Vec(v1,3)); // 3, also ParallelReduce, Plus(), Minimum() or any associative lambda
 //
 // AVec(v,3) = Num(2) + Num(3)*Vec(v1); // v = {5,8,11}
 // AVec(v,3) = Num(1) + Dot(Vec(v1,2),Vec(v1)); // v = {6,6,6}
 //
 // int i = Num(2); // i = 2;
 //
+// AVec(v,3) += Num(2) * Vec(v1); // v = {7,12,17}, v is read and written once per coordinate, also -=, *=, /=
+// AVec(v,3) /= 2; // scalars are allowed on the right side of compound assignments
+//
+// Stream(AVec(v,3)) = Vec(v1) + Vec(v2); // v = {4,6,8}, written with non-temporal stores bypassing cache
+// AVec(v,3) = Vec(v1); AVec(v,3) = Num(0); // plain copies and fills of contiguous arrays are done by memmove and memset
+//
+// float xyz[] = {1,2,3, 4,5,6}; // two 3d points interleaved
+// float x[2], y[2], z[2]; float * soa[] = {x, y, z};
+// AVecNSoA<3>(soa, 2) = VecN<3>(xyz) + Num(1.f); // x = {2,5}, y = {3,6}, z = {4,7}
+// float sy = Dot(Component(VecN<3>(xyz, 2), 1), Vec(y)); // 2*3 + 5*6 = 36
+// AVec(v,3) = Cross(Vec(v1,3), Vec(v2)); // v = {-2,4,-2}
+// int m[6]; AMat(m, 3, 2) = Outer(Vec(v1,3), Vec(v2,2)); // m = {3,4, 6,8, 9,12}
+// Rank1Update(AMat(m, 3, 2), 2, Vec(v1,3), Vec(v2,2)); // m += 2 * v1 * v2^T
+// AMat(m, 3, 2) = (Mat(m, 3, 2) - RowBroadcast(Vec(mean, 2))) / ColBroadcast(Vec(scale, 3)); // one pass over m
+// Covariance(Mat(samples, n, d), AMat(cov, d, d)); Gram(Mat(samples, n, d), AMat(gram, n, n));
+// PairwiseDistances(Mat(points, n, d), Mat(centroids, k, d), Metric::L2, AMat(dist, n, k));
+// Transpose(Mat(a, n, d), AMat(at, d, n)); Transpose(AMat(sq, n, n)); // out of place and in place for square matrices
+// RowReduce(Mat(points, n, d), Reduction::Norm, AVec(norms, n)); ColReduce(Mat(points, n, d), Reduction::Mean, AVec(mean, d));
+//
+// AVec(x, 2) = BatchDot(VecN<3>(xyz, 2), VecN<3>(xyz)); // x = {14, 77}, also BatchCross, BatchNorm, BatchNormalize
+//
 // double v3[] = {1.0, 2.0, 3.0};
 // float v4[3];
 // AVec(v4,3) = Cast<float>(Vec(v3));
+// AVec(v4,3) = Map([](double x, float y) { return float(x * y); }, Vec(v3), Vec(v4)); // v4 = {1,4,9}, user function
+// std::uint8_t px[3];
+// AVec(px,3) = Convert<std::uint8_t>(Vec(v3) * Num(100.0)); // px = {100,200,255}, rounded to nearest and saturated
+//
+// Expressions are simplified at compile time: Num(2) * Num(3) is Num(6), -(-Vec(v1)) and Cast<int>(Vec(v1)) are Vec(v1),
+// Zero<int>() + Vec(v1) and One<int>() * Vec(v1) are Vec(v1), so generic code pays nothing for neutral elements.
 // 
 
 
 #pragma once
 
 #include <type_traits>
+#include <cstdint>
+#include <utility>
+#include <tuple>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <cassert>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define VEVI_SSE2
+#endif
+
+// Assignments to contiguous vectors of at least this many bytes use non-temporal (streaming) stores,
+// which bypass the cache. Define it before including the header to tune for the target machine.
+#ifndef VEVI_STREAMING_THRESHOLD
+#define VEVI_STREAMING_THRESHOLD (4 * 1024 * 1024)
+#endif
+
+// Upper limit of threads used by parallel kernels, 0 means number of hardware threads.
+#ifndef VEVI_MAX_THREADS
+#define VEVI_MAX_THREADS 0
+#endif
 
 namespace vevi
 {
+	// Rounding of floating point values converted to integers. Nearest rounds halves to even.
+	enum class Rounding
+	{
+		Nearest,
+		Truncate,
+		Floor,
+		Ceil
+	};
+
+	// Associative combiners for Reduce and ParallelReduce, identities are 0, the largest and the smallest value of type
+	struct Plus
+	{
+		template<typename T>
+		T operator()(const T & a, const T & b) const { return a + b; }
+	};
+
+	struct Minimum
+	{
+		template<typename T>
+		T operator()(const T & a, const T & b) const { return b < a ? b : a; }
+	};
+
+	struct Maximum
+	{
+		template<typename T>
+		T operator()(const T & a, const T & b) const { return a < b ? b : a; }
+	};
+
 	namespace details
 	{
+		// Value of one element of multi-component vector (e.g. xyz of a point in point cloud).
+		// Arithmetic on it is component-wise so expressions over multi-component views are evaluated for all components at once.
+		template<typename T, int K>
+		struct Point
+		{
+			using ScalarType = T;
+			static const int size = K;
+			T c[K];
+			T & operator[](int i) { return c[i]; }
+			const T & operator[](int i) const { return c[i]; }
+		};
+
+		template<typename T, int K>
+		inline Point<T, K> operator+(const Point<T, K> & a, const Point<T, K> & b)
+		{
+			Point<T, K> r;
+			for (int k = 0; k < K; ++k) r[k] = a[k] + b[k];
+			return r;
+		}
+		template<typename T, int K>
+		inline Point<T, K> operator-(const Point<T, K> & a, const Point<T, K> & b)
+		{
+			Point<T, K> r;
+			for (int k = 0; k < K; ++k) r[k] = a[k] - b[k];
+			return r;
+		}
+		template<typename T, int K>
+		inline Point<T, K> operator-(const Point<T, K> & a)
+		{
+			Point<T, K> r;
+			for (int k = 0; k < K; ++k) r[k] = -a[k];
+			return r;
+		}
+		// Number acts on every component
+		template<typename T, int K>
+		inline Point<T, K> operator+(const T & a, const Point<T, K> & b)
+		{
+			Point<T, K> r;
+			for (int k = 0; k < K; ++k) r[k] = a + b[k];
+			return r;
+		}
+		template<typename T, int K>
+		inline Point<T, K> operator+(const Point<T, K> & a, const T & b) { return b + a; }
+		template<typename T, int K>
+		inline Point<T, K> operator-(const T & a, const Point<T, K> & b) { return a + -b; }
+		template<typename T, int K>
+		inline Point<T, K> operator-(const Point<T, K> & a, const T & b) { return a + -b; }
+
 		// Standard storages of coordinates for which Views can be created.
 		// User can define his own storages. It has to have members: ElementType, operator[], support move semantics.
 		namespace storages
@@ -80,6 +213,7 @@ namespace vevi
 					return ptr[idx];
 				}
 				ArrayPtr(const Ptr & ptr) : ptr(ptr) {}
+				Ptr Data() const { return ptr; }
 			private:
 				const Ptr ptr;
 			};
@@ -94,6 +228,8 @@ namespace vevi
 					return ptr[idx*stride];
 				}
 				StridedArrayPtr(const Ptr & ptr, int stride) : ptr(ptr), stride(stride) {}
+				Ptr Data() const { return ptr; }
+				int Stride() const { return stride; }
 			private:
 				Ptr const ptr;
 				const int stride;
@@ -115,10 +251,172 @@ namespace vevi
 					buf = oa.buf;
 					oa.buf = nullptr;
 				}
+				OwnedArray<T> & operator=(OwnedArray<T> && oa)
+				{
+					std::swap(buf, oa.buf);
+					return *this;
+				}
+				OwnedArray(const OwnedArray<T> &) = delete;
+				OwnedArray<T> & operator=(const OwnedArray<T> &) = delete;
+				T * Data() const { return buf; }
 			private:
-				OwnedArray(const OwnedArray<T> & oa){}
 				T * buf = nullptr;
 			};
+
+			// Storage that owns memory for coordinates. Up to N coordinates are kept inside the object without allocation,
+			// more are allocated on heap. Capacity never shrinks, so buffer is reused by results of smaller sizes.
+			template<typename T, int N>
+			struct SmallBufferArray
+			{
+				using ElementType = T;
+				T & operator[](int idx) const
+				{
+					return ptr[idx];
+				}
+				SmallBufferArray(int capacity)
+				{
+					if (capacity > N)
+					{
+						heap = new T[capacity];
+						ptr = heap;
+						cap = capacity;
+					}
+				}
+				~SmallBufferArray() { delete[] heap; }
+				SmallBufferArray(SmallBufferArray<T, N> && sb)
+				{
+					Take(sb);
+				}
+				SmallBufferArray<T, N> & operator=(SmallBufferArray<T, N> && sb)
+				{
+					if (this != &sb)
+					{
+						delete[] heap;
+						Take(sb);
+					}
+					return *this;
+				}
+				SmallBufferArray(const SmallBufferArray<T, N> &) = delete;
+				SmallBufferArray<T, N> & operator=(const SmallBufferArray<T, N> &) = delete;
+
+				T * Data() const { return ptr; }
+				int Capacity() const { return cap; }
+
+				// Makes room for capacity coordinates keeping first keep of them
+				void Reserve(int capacity, int keep)
+				{
+					if (capacity <= cap) return;
+					T * fresh = new T[capacity];
+					for (int i = 0; i < keep; ++i) fresh[i] = ptr[i];
+					delete[] heap;
+					heap = ptr = fresh;
+					cap = capacity;
+				}
+			private:
+				void Take(SmallBufferArray<T, N> & sb)
+				{
+					if (sb.heap)
+					{
+						heap = ptr = sb.heap;
+						cap = sb.cap;
+						sb.heap = nullptr;
+						sb.ptr = sb.local;
+						sb.cap = N;
+					}
+					else
+					{
+						for (int i = 0; i < N; ++i) local[i] = sb.local[i];
+						heap = nullptr;
+						ptr = local;
+						cap = N;
+					}
+				}
+
+				T local[N];
+				T * heap = nullptr;
+				T * ptr = local;
+				int cap = N;
+			};
+
+			// Storage of K-component elements interleaved in one array (array of structures): x0 y0 z0 x1 y1 z1 ...
+			// Its elements are Points, single component is viewed by StridedArrayPtr. Support const T* and T* cases
+			template<typename Ptr, int K>
+			struct AosArrayPtr
+			{
+				using ScalarType = typename std::remove_const<typename std::remove_pointer<Ptr>::type>::type;
+				using ElementType = Point<ScalarType, K>;
+				using ComponentStorage = StridedArrayPtr<Ptr>;
+
+				// Proxy for element in the array, is read as Point and can be assigned by Point
+				struct Reference
+				{
+					Ptr p;
+					operator ElementType() const
+					{
+						ElementType r;
+						for (int k = 0; k < K; ++k) r[k] = p[k];
+						return r;
+					}
+					const Reference & operator=(const ElementType & v) const
+					{
+						for (int k = 0; k < K; ++k) p[k] = v[k];
+						return *this;
+					}
+				};
+
+				Reference operator[](int idx) const
+				{
+					Reference r = { ptr + idx * K };
+					return r;
+				}
+				ComponentStorage Component(int k) const { return ComponentStorage(ptr + k, K); }
+				AosArrayPtr(const Ptr & ptr) : ptr(ptr) {}
+				Ptr Data() const { return ptr; }
+			private:
+				const Ptr ptr;
+			};
+
+			// Storage of K-component elements kept in K separate arrays (structure of arrays): x0 x1 ..., y0 y1 ..., z0 z1 ...
+			// Its elements are Points, single component is viewed by ArrayPtr. Support const T* and T* cases
+			template<typename Ptr, int K>
+			struct SoaArrayPtr
+			{
+				using ScalarType = typename std::remove_const<typename std::remove_pointer<Ptr>::type>::type;
+				using ElementType = Point<ScalarType, K>;
+				using ComponentStorage = ArrayPtr<Ptr>;
+
+				struct Reference
+				{
+					const Ptr * comps;
+					int idx;
+					operator ElementType() const
+					{
+						ElementType r;
+						for (int k = 0; k < K; ++k) r[k] = comps[k][idx];
+						return r;
+					}
+					const Reference & operator=(const ElementType & v) const
+					{
+						for (int k = 0; k < K; ++k) comps[k][idx] = v[k];
+						return *this;
+					}
+				};
+
+				Reference operator[](int idx) const
+				{
+					Reference r = { comps, idx };
+					return r;
+				}
+				ComponentStorage Component(int k) const { return ComponentStorage(comps[k]); }
+				// comps is array of K pointers to components' arrays
+				template<typename CompPtr>
+				SoaArrayPtr(const CompPtr * comps)
+				{
+					for (int k = 0; k < K; ++k) this->comps[k] = comps[k];
+				}
+			private:
+				Ptr comps[K];
+			};
 		}
 
 		template<typename T>
@@ -132,6 +430,32 @@ namespace vevi
 			operator T() const { return num; }
 		};
 
+		// Numbers known at compile time to be neutral elements. Operations with them are removed from expressions.
+		template<typename T>
+		class ZeroView
+		{
+		public:
+			using type = T;
+			T Evaluate(int) const { return T(0); }
+			operator T() const { return T(0); }
+		};
+
+		template<typename T>
+		class OneView
+		{
+		public:
+			using type = T;
+			T Evaluate(int) const { return T(1); }
+			operator T() const { return T(1); }
+		};
+
+		// Operation with neutral element can be dropped only if it does not change the type of the other operand
+		template<template<typename, typename> class Op, typename Arg1, typename Arg2, typename Arg>
+		struct Identity
+		{
+			static bool const value = std::is_same<typename Op<Arg1, Arg2>::type, typename Arg::type>::value;
+		};
+
 		template<typename Storage>
 		class VectorView
 		{
@@ -142,6 +466,7 @@ namespace vevi
 			VectorView(Storage storage, int dim) : dim(dim), storage(std::move(storage)) {}
 			type Evaluate(int i) const { return storage[i]; }
 			int Dim() const { return dim; }
+			const Storage & GetStorage() const { return storage; }
 		};
 
 		// Not Dimentional Vector is a vector with no dimention specified. Usage of it is controlled by other vectors' dimentions in expression.
@@ -154,228 +479,2291 @@ namespace vevi
 			using type = typename Storage::ElementType;
 			NoDimVectorView(Storage storage) : storage(std::move(storage)) {}
 			type Evaluate(int i) const { return storage[i]; }
+			const Storage & GetStorage() const { return storage; }
 		};
 
-		template<typename Storage>
-		class AssignableVectorView
+		// Helper class to check if class has a member function "int Dim() const"
+		template <typename T>
+		class HasMemberDim
 		{
-			const int dim;
-			const Storage storage;
+			typedef char Yes;
+			typedef Yes No[2];
+			template <typename U, U> struct really_has;
+			template <typename C> static Yes& Test(really_has<int (C::*)() const, &C::Dim>*);
+			template <typename> static No& Test(...);
 		public:
-			using type = typename Storage::ElementType;
-			AssignableVectorView(Storage storage, int dim) : dim(dim), storage(std::move(storage)) {}
-			type Evaluate(int i) const { return storage[i]; }
-			int Dim() const { return dim; }
-			type operator[](int i) const { return storage[i]; }
+			static bool const value = sizeof(Test<T>(0)) == sizeof(Yes);
+		};
 
-			template<typename Expr>
-			AssignableVectorView<Storage> & operator=(const Expr & expr)
-			{
-				for (int i = 0; i < dim; ++i)
-					storage[i] = expr.Evaluate(i);
-				return *this;
-			}
+		// Helper class to check if class is vector expression, i.e. has a member function "type Evaluate(int) const".
+		// Operators are enabled only for expressions so that they do not catch arithmetic of other types found by ADL.
+		template <typename T>
+		class IsExpression
+		{
+			typedef char Yes;
+			typedef Yes No[2];
+			template <typename U, U> struct really_has;
+			template <typename C> static Yes& Test(really_has<typename C::type (C::*)(int) const, &C::Evaluate>*);
+			template <typename> static No& Test(...);
+		public:
+			static bool const value = sizeof(Test<T>(0)) == sizeof(Yes);
 		};
 
-		// Helper class to check if class has a member function "int Dim() const"
+		// Helper class to check if class is matrix expression, i.e. has a member function "type Evaluate(int, int) const"
 		template <typename T>
-		class HasMemberDim
+		class IsMatrixExpression
 		{
 			typedef char Yes;
 			typedef Yes No[2];
 			template <typename U, U> struct really_has;
-			template <typename C> static Yes& Test(really_has<int (C::*)() const, &C::Dim>*);
+			template <typename C> static Yes& Test(really_has<typename C::type (C::*)(int, int) const, &C::Evaluate>*);
 			template <typename> static No& Test(...);
 		public:
 			static bool const value = sizeof(Test<T>(0)) == sizeof(Yes);
 		};
 
-		// If first argument has Dim then use it, otherwise use Dim of the second argument.
-		// If there is no Dim of the second argument there will be compilation error 
-		// meaning that vector operation can not be performed because dimentionality is not known
+		// Vector operators take at least one vector expression and no matrices, matrix operators take at least one matrix.
+		// Number views are valid operands of both.
 		template<typename Arg1, typename Arg2>
-		struct Dimention
+		struct VectorOperands
 		{
-			template<typename U = Arg1>
-			static typename std::enable_if<HasMemberDim<U>::value, int>::type Dim(const Arg1 & a1, const Arg2 & a2)
+			static bool const value = (IsExpression<Arg1>::value || IsExpression<Arg2>::value) &&
+				!IsMatrixExpression<Arg1>::value && !IsMatrixExpression<Arg2>::value;
+		};
+		template<typename Arg1, typename Arg2>
+		struct MatrixOperands
+		{
+			static bool const value = IsMatrixExpression<Arg1>::value || IsMatrixExpression<Arg2>::value;
+		};
+
+		// Conversion of one value with rounding and optional saturation to the range of T. Saturated NaN becomes 0,
+		// without saturation out of range values wrap like integer casts.
+		template<typename T, typename S>
+		inline typename std::enable_if<std::is_integral<T>::value && std::is_floating_point<S>::value, T>::type
+			ConvertValue(S x, Rounding rounding, bool saturate)
+		{
+			const double v = rounding == Rounding::Nearest ? std::nearbyint(double(x)) : rounding == Rounding::Floor ? std::floor(double(x)) :
+				rounding == Rounding::Ceil ? std::ceil(double(x)) : std::trunc(double(x));
+			if (!saturate)
+				return T(static_cast<long long>(v));
+			if (v != v)
+				return T(0);
+			if (v <= double(std::numeric_limits<T>::min()))
+				return std::numeric_limits<T>::min();
+			if (v >= double(std::numeric_limits<T>::max()))
+				return std::numeric_limits<T>::max();
+			return T(v);
+		}
+
+		template<typename T, typename S>
+		inline typename std::enable_if<std::is_integral<T>::value && std::is_integral<S>::value, T>::type
+			ConvertValue(S x, Rounding, bool saturate)
+		{
+			if (saturate)
 			{
-				return a1.Dim();
+				if (std::is_signed<S>::value && x < S(0))
+				{
+					if (!std::is_signed<T>::value)
+						return T(0);
+					if (static_cast<long long>(x) < static_cast<long long>(std::numeric_limits<T>::min()))
+						return std::numeric_limits<T>::min();
+				}
+				else if (static_cast<unsigned long long>(x) > static_cast<unsigned long long>(std::numeric_limits<T>::max()))
+					return std::numeric_limits<T>::max();
 			}
+			return T(x);
+		}
 
-			template<typename U = Arg1>
-			static typename std::enable_if<!HasMemberDim<U>::value, int>::type Dim(const Arg1 & a1, const Arg2 & a2)
+		template<typename T, typename S>
+		inline typename std::enable_if<std::is_floating_point<T>::value, T>::type ConvertValue(S x, Rounding, bool saturate)
+		{
+			if (saturate && std::is_floating_point<S>::value && sizeof(S) > sizeof(T))
 			{
-				return a2.Dim();
+				if (x > S(std::numeric_limits<T>::max())) return std::numeric_limits<T>::max();
+				if (x < S(std::numeric_limits<T>::lowest())) return std::numeric_limits<T>::lowest();
 			}
+			return T(x);
+		}
+
+		// Saturating conversion of floats to 8, 16 and 32 bit integers with SSE2 converts and packs, 16 values at a time.
+		// Only rounding modes of conversion instructions are supported: Nearest (default MXCSR mode) and Truncate.
+		template<typename S, typename T>
+		struct ConvertKernel
+		{
+			static const bool supported = false;
+			static void run(const S *, T *, int, Rounding) {}
 		};
 
-		template<typename Arg1, typename Arg2>
-		struct VectorAdd
+#ifdef VEVI_SSE2
+		template<typename T>
+		struct ConvertKernel<float, T>
 		{
-			using type = decltype(Arg1::type() + Arg2::type());
-			static type run(int i, const Arg1 & v1, const Arg2 & v2)
+			static const bool supported = std::is_integral<T>::value && !std::is_same<T, bool>::value && sizeof(T) <= 4 &&
+				!(std::is_unsigned<T>::value && sizeof(T) > 1);
+
+			static void run(const float * src, T * dst, int n, Rounding rounding)
 			{
-				return v1.Evaluate(i) + v2.Evaluate(i);
+				// 2^31 is not representable in int32, it converts to 0x80000000 and is flipped to INT_MAX by the mask below
+				const __m128 lo = _mm_set1_ps(float(std::numeric_limits<T>::min()));
+				const __m128 hi = _mm_set1_ps(sizeof(T) == 4 ? 2147483648.f : float(std::numeric_limits<T>::max()));
+				const bool truncate = rounding == Rounding::Truncate;
+				int i = 0;
+				for (; i + 16 <= n; i += 16)
+				{
+					__m128i r[4];
+					for (int k = 0; k < 4; ++k)
+					{
+						__m128 x = _mm_loadu_ps(src + i + 4 * k);
+						x = _mm_and_ps(x, _mm_cmpord_ps(x, x));
+						x = _mm_min_ps(_mm_max_ps(x, lo), hi);
+						r[k] = truncate ? _mm_cvttps_epi32(x) : _mm_cvtps_epi32(x);
+						if (sizeof(T) == 4)
+							r[k] = _mm_xor_si128(r[k], _mm_castps_si128(_mm_cmpge_ps(x, hi)));
+					}
+					__m128i * out = reinterpret_cast<__m128i*>(dst + i);
+					if (sizeof(T) == 4)
+					{
+						for (int k = 0; k < 4; ++k)
+							_mm_storeu_si128(out + k, r[k]);
+					}
+					else if (sizeof(T) == 2)
+					{
+						_mm_storeu_si128(out, _mm_packs_epi32(r[0], r[1]));
+						_mm_storeu_si128(out + 1, _mm_packs_epi32(r[2], r[3]));
+					}
+					else
+					{
+						const __m128i a = _mm_packs_epi32(r[0], r[1]), b = _mm_packs_epi32(r[2], r[3]);
+						_mm_storeu_si128(out, std::is_signed<T>::value ? _mm_packs_epi16(a, b) : _mm_packus_epi16(a, b));
+					}
+				}
+				for (; i < n; ++i)
+					dst[i] = ConvertValue<T>(src[i], rounding, true);
 			}
 		};
+#endif
 
-		template<typename Arg1, typename Arg2>
-		struct VectorSub
+		// Conversion of vector expression to TargetType, i.e. Convert<std::uint8_t>(...)
+		template<typename Arg1, typename TargetType>
+		class ConvertOp
 		{
-			using type = decltype(Arg1::type() - Arg2::type());
-			static type run(int i, const Arg1 & v1, const Arg2 & v2)
-			{
-				return v1.Evaluate(i) - v2.Evaluate(i);
-			}
+			const Arg1 & v;
+			const Rounding rounding;
+			const bool saturate;
+		public:
+			using type = TargetType;
+			ConvertOp(const Arg1 & v, Rounding rounding, bool saturate) : v(v), rounding(rounding), saturate(saturate) {}
+			type Evaluate(int i) const { return ConvertValue<TargetType>(v.Evaluate(i), rounding, saturate); }
+			const Arg1 & Source() const { return v; }
+			Rounding GetRounding() const { return rounding; }
+			bool Saturate() const { return saturate; }
+
+			template<typename U = Arg1>
+			typename std::enable_if<HasMemberDim<U>::value, int>::type
+				Dim() const { return v.Dim(); }
 		};
 
-		template<typename Arg1, typename Arg2>
-		struct DotProd
+		// Storages that decode a range of coordinates faster than one by one (compressed ones) have a member
+		// "void Decode(int begin, int count, ElementType * out) const" with begin a multiple of DecodeBlock.
+		// Expressions over them are assigned and dotted in blocks: their leaves are decoded into buffers owned by
+		// the evaluation, so views stay stateless and can be shared between threads.
+		const int DecodeBlock = 128;
+
+		template <typename T>
+		class HasDecode
 		{
-			using type = decltype(Arg1::type() * Arg2::type());
-			static type run(const Arg1 & d1, const Arg2 & d2)
-			{
-				type res = type(0);
-				for (int i = 0; i < Dimention<Arg1, Arg2>::Dim(d1, d2); ++i)
-					res += d1.Evaluate(i) * d2.Evaluate(i);
-				return res;
-			}
+			typedef char Yes;
+			typedef Yes No[2];
+			template <typename U, U> struct really_has;
+			template <typename C> static Yes& Test(really_has<void (C::*)(int, int, typename C::ElementType *) const, &C::Decode>*);
+			template <typename> static No& Test(...);
+		public:
+			static bool const value = sizeof(Test<T>(0)) == sizeof(Yes);
 		};
 
-		template<typename Arg1>
-		struct VectorNeg
+		// Whether expression has leaves with block decoding, extended for operation nodes below
+		template<typename Expr>
+		struct BlockDecoded
 		{
-			using type = decltype(-Arg1::type());
-			static type run(int i, const Arg1 & v1)
+			static bool const value = false;
+		};
+		template<typename Storage>
+		struct BlockDecoded<VectorView<Storage>>
+		{
+			static bool const value = HasDecode<Storage>::value;
+		};
+
+		// Copy of expression tree evaluated block by block: Load(begin) decodes leaves for coordinates
+		// [begin, begin + DecodeBlock), after that Evaluate(i) may be called for them
+		template<typename Expr, bool = BlockDecoded<Expr>::value>
+		class BlockTree
+		{
+			const Expr & e;
+		public:
+			using type = typename Expr::type;
+			BlockTree(const Expr & e) : e(e) {}
+			void Load(int) {}
+			type Evaluate(int i) const { return e.Evaluate(i); }
+		};
+
+		template<typename Storage>
+		class BlockTree<VectorView<Storage>, true>
+		{
+			const Storage & storage;
+			const int dim;
+			int begin = 0;
+		public:
+			using type = typename Storage::ElementType;
+		private:
+			type buf[DecodeBlock];
+		public:
+			BlockTree(const VectorView<Storage> & v) : storage(v.GetStorage()), dim(v.Dim()) {}
+			void Load(int b)
 			{
-				return -v1.Evaluate(i);
+				begin = b;
+				storage.Decode(b, dim - b < DecodeBlock ? dim - b : DecodeBlock, buf);
 			}
+			type Evaluate(int i) const { return buf[i - begin]; }
 		};
 
-		template<typename Arg1, typename TargetType>
-		struct VectorCast
+		// Hint to bring cache line with p to L1 ahead of its use
+		inline void Prefetch(const void * p)
 		{
-			using type = TargetType;
-			static type run(int i, const Arg1 & v1)
+#ifdef VEVI_SSE2
+			_mm_prefetch(static_cast<const char*>(p), _MM_HINT_T0);
+#else
+			(void)p;
+#endif
+		}
+
+		// Contiguous leaves of block trees prefetch a few blocks ahead: decoding of compressed leaves does not touch memory,
+		// without hints the stream of contiguous operands would stall while a block is decoded
+		const int PrefetchBlocks = 4;
+
+		template<typename Ptr>
+		class ContiguousBlockTree
+		{
+			const Ptr ptr;
+		public:
+			using type = typename std::remove_cv<typename std::remove_pointer<Ptr>::type>::type;
+			ContiguousBlockTree(Ptr ptr) : ptr(ptr) {}
+			void Load(int b)
 			{
-				return (type)v1.Evaluate(i);
+				const char * ahead = reinterpret_cast<const char*>(ptr + b + PrefetchBlocks * DecodeBlock);
+				for (size_t line = 0; line < DecodeBlock * sizeof(type); line += 64)
+					Prefetch(ahead + line);
 			}
+			type Evaluate(int i) const { return ptr[i]; }
 		};
 
-		template<template <typename, typename, typename...> class Op, typename Arg1, typename Arg2, typename ...Args>
-		class BinOp
+		template<typename Ptr>
+		class BlockTree<VectorView<storages::ArrayPtr<Ptr>>, false> : public ContiguousBlockTree<Ptr>
 		{
-			const Arg1 & v1;
-			const Arg2 & v2;
 		public:
-			using type = typename Op<Arg1, Arg2, Args...>::type;
-			BinOp(const Arg1 & v1, const Arg2 & v2) : v1(v1), v2(v2) {}
-			type Evaluate(int i) const { return Op<Arg1, Arg2, Args...>::run(i, v1, v2); }
-
-			template<typename U = Arg1, typename V = Arg2>
-			typename std::enable_if<HasMemberDim<U>::value || HasMemberDim<V>::value, int>::type
-				Dim() const { return details::Dimention<U, V>::Dim(v1, v2); }
+			BlockTree(const VectorView<storages::ArrayPtr<Ptr>> & v) : ContiguousBlockTree<Ptr>(v.GetStorage().Data()) {}
 		};
 
-		template<template <typename, typename...> class Op, typename Arg1, typename ... Args >
-		class UnaOp
+		template<typename Ptr>
+		class BlockTree<NoDimVectorView<storages::ArrayPtr<Ptr>>, false> : public ContiguousBlockTree<Ptr>
 		{
-			const Arg1 & v;
 		public:
-			using type = typename Op<Arg1, Args...>::type;
-			UnaOp(const Arg1 & v) : v(v) {}
-			type Evaluate(int i) const { return Op<Arg1, Args...>::run(i, v); }
-
-			template<typename U = Arg1>
-			typename std::enable_if<HasMemberDim<U>::value, int>::type
-				Dim() const { return v.Dim(); }
+			BlockTree(const NoDimVectorView<storages::ArrayPtr<Ptr>> & v) : ContiguousBlockTree<Ptr>(v.GetStorage().Data()) {}
 		};
 
-	}
+		// Writes at(0), ..., at(n - 1) of a loaded block to out, which is a local buffer of the caller,
+		// so full blocks are a loop of constant length over buffers in L1 that compilers vectorize
+		template<typename T, typename At>
+		inline void EvaluateBlock(const At & at, int n, T * out)
+		{
+			if (n == DecodeBlock)
+				for (int i = 0; i < DecodeBlock; ++i) out[i] = T(at(i));
+			else
+				for (int i = 0; i < n; ++i) out[i] = T(at(i));
+		}
 
-	// Assignable Vector
-	template<typename T>
-	inline details::AssignableVectorView<details::storages::ArrayPtr<T*>> AVec(T * ptr, int dim)
-	{
-		return{ { ptr }, dim };
-	}
-	template<typename T>
-	inline details::AssignableVectorView<details::storages::StridedArrayPtr<T*>> AVec(T * ptr, int dim, int stride)
-	{
+		// Writes values of expression to storage coordinate by coordinate.
+		template<typename Storage>
+		struct Assigner
+		{
+			template<typename Expr>
+			static void run(const Storage & storage, int dim, const Expr & expr, bool)
+			{
+				for (int i = 0; i < dim; ++i)
+					storage[i] = expr.Evaluate(i);
+			}
+		};
+
+		// Non-temporal stores write whole 16 byte packets directly to memory, avoiding cache pollution and read-for-ownership
+		// of destination lines. Worth it only for big destinations that will not be read again soon.
+		template<typename T>
+		struct StreamingStore
+		{
+			static const bool supported =
+#ifdef VEVI_SSE2
+				std::is_arithmetic<T>::value && sizeof(T) <= 16 && 16 % sizeof(T) == 0;
+#else
+				false;
+#endif
+			static const int lanes = sizeof(T) <= 16 ? int(16 / sizeof(T)) : 1;
+
+			template<typename Expr>
+			static void run(T * dst, int dim, const Expr & expr)
+			{
+#ifdef VEVI_SSE2
+				int i = 0;
+				if (reinterpret_cast<std::uintptr_t>(dst) % sizeof(T) == 0)
+				{
+					// Scalar head until destination is aligned to packet boundary
+					for (; i < dim && reinterpret_cast<std::uintptr_t>(dst + i) % 16 != 0; ++i)
+						dst[i] = expr.Evaluate(i);
+					for (; i + lanes <= dim; i += lanes)
+					{
+						union { __m128i reg; T lane[lanes]; } packet;
+						for (int k = 0; k < lanes; ++k)
+							packet.lane[k] = expr.Evaluate(i + k);
+						_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i), packet.reg);
+					}
+				}
+				for (; i < dim; ++i)
+					dst[i] = expr.Evaluate(i);
+				// Streaming stores are weakly ordered, make them visible before anything that follows
+				_mm_sfence();
+#else
+				for (int i = 0; i < dim; ++i)
+					dst[i] = expr.Evaluate(i);
+#endif
+			}
+
+			// Makes streaming stores visible before anything that follows
+			static void Fence()
+			{
+#ifdef VEVI_SSE2
+				_mm_sfence();
+#endif
+			}
+
+			// Copy of contiguous array that does not overlap destination, packets are loaded unaligned.
+			// Callers that copy piece by piece pass fence = false and call Fence() after the last piece
+			static void copy(T * dst, const T * src, int dim, bool fence = true)
+			{
+#ifdef VEVI_SSE2
+				int i = 0;
+				if (reinterpret_cast<std::uintptr_t>(dst) % sizeof(T) == 0)
+				{
+					for (; i < dim && reinterpret_cast<std::uintptr_t>(dst + i) % 16 != 0; ++i)
+						dst[i] = src[i];
+					for (; i + lanes <= dim; i += lanes)
+						_mm_stream_si128(reinterpret_cast<__m128i*>(dst + i), _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+				}
+				for (; i < dim; ++i)
+					dst[i] = src[i];
+				if (fence)
+					Fence();
+#else
+				(void)fence;
+				for (int i = 0; i < dim; ++i)
+					dst[i] = src[i];
+#endif
+			}
+		};
+
+		// Contiguous arrays switch to streaming stores when requested or when destination exceeds VEVI_STREAMING_THRESHOLD.
+		// Plain copies, strided gathers and fills with a number have bulk routines.
+		template<typename T>
+		struct Assigner<storages::ArrayPtr<T*>>
+		{
+			static bool Streamed(int dim, bool stream)
+			{
+				return StreamingStore<T>::supported && (stream || double(dim) * sizeof(T) >= VEVI_STREAMING_THRESHOLD);
+			}
+
+			template<typename Expr>
+			static void run(const storages::ArrayPtr<T*> & storage, int dim, const Expr & expr, bool stream)
+			{
+				T * dst = storage.Data();
+				if (BlockDecoded<Expr>::value)
+				{
+					Blocks(dst, dim, expr, Streamed(dim, stream));
+					return;
+				}
+				if (Streamed(dim, stream))
+				{
+					StreamingStore<T>::run(dst, dim, expr);
+					return;
+				}
+				for (int i = 0; i < dim; ++i)
+					dst[i] = expr.Evaluate(i);
+			}
+
+			// Every block is decoded and evaluated in L1, then written out whole (streamed for big destinations),
+			// so compressed leaves are read once and destination costs the same as for dense expressions
+			template<typename Expr>
+			static void Blocks(T * dst, int dim, const Expr & expr, bool streamed)
+			{
+				BlockTree<Expr> tree(expr);
+				T buf[DecodeBlock];
+				for (int b = 0; b < dim; b += DecodeBlock)
+				{
+					const int n = dim - b < DecodeBlock ? dim - b : DecodeBlock;
+					tree.Load(b);
+					EvaluateBlock([&](int i) { return tree.Evaluate(b + i); }, n, buf);
+					if (streamed)
+						StreamingStore<T>::copy(dst + b, buf, n, false);
+					else
+						std::copy(buf, buf + n, dst + b);
+				}
+				if (streamed)
+					StreamingStore<T>::Fence();
+			}
+
+			// Source may overlap destination, the result is as if it was read before writing
+			static void Copy(T * dst, const T * src, int dim, bool stream)
+			{
+				if (dim <= 0 || dst == src)
+					return;
+				const bool overlap = dst < src + dim && src < dst + dim;
+				if (Streamed(dim, stream) && !overlap)
+					StreamingStore<T>::copy(dst, src, dim);
+				else if (std::is_trivially_copyable<T>::value)
+					std::memmove(dst, src, size_t(dim) * sizeof(T));
+				else if (dst < src)
+					for (int i = 0; i < dim; ++i) dst[i] = src[i];
+				else
+					for (int i = dim - 1; i >= 0; --i) dst[i] = src[i];
+			}
+
+			static void run(const storages::ArrayPtr<T*> & storage, int dim, const VectorView<storages::ArrayPtr<const T*>> & expr, bool stream)
+			{
+				Copy(storage.Data(), expr.GetStorage().Data(), dim, stream);
+			}
+
+			static void run(const storages::ArrayPtr<T*> & storage, int dim, const NoDimVectorView<storages::ArrayPtr<const T*>> & expr, bool stream)
+			{
+				Copy(storage.Data(), expr.GetStorage().Data(), dim, stream);
+			}
+
+			// Strided gather with the source pointer advanced by the stride, unrolled by 4
+			static void run(const storages::ArrayPtr<T*> & storage, int dim, const VectorView<storages::StridedArrayPtr<const T*>> & expr, bool stream)
+			{
+				T * dst = storage.Data();
+				const T * src = expr.GetStorage().Data();
+				const int stride = expr.GetStorage().Stride();
+				if (stride == 1)
+				{
+					Copy(dst, src, dim, stream);
+					return;
+				}
+				if (Streamed(dim, stream))
+				{
+					StreamingStore<T>::run(dst, dim, expr);
+					return;
+				}
+				int i = 0;
+				for (; i + 4 <= dim; i += 4, src += 4 * stride)
+				{
+					dst[i] = src[0];
+					dst[i + 1] = src[stride];
+					dst[i + 2] = src[2 * stride];
+					dst[i + 3] = src[3 * stride];
+				}
+				for (; i < dim; ++i, src += stride)
+					dst[i] = *src;
+			}
+
+			// Fill with one value, memset for numbers with all bits zero
+			static void Fill(T * dst, int dim, const T & value, bool stream)
+			{
+				if (dim <= 0)
+					return;
+				if (Streamed(dim, stream))
+				{
+					StreamingStore<T>::run(dst, dim, NumberView<T>(value));
+					return;
+				}
+				if (std::is_arithmetic<T>::value)
+				{
+					const unsigned char * bytes = reinterpret_cast<const unsigned char*>(&value);
+					bool zero = true;
+					for (size_t k = 0; k < sizeof(T); ++k) zero = zero && bytes[k] == 0;
+					if (zero)
+					{
+						std::memset(dst, 0, size_t(dim) * sizeof(T));
+						return;
+					}
+				}
+				for (int i = 0; i < dim; ++i)
+					dst[i] = value;
+			}
+
+			template<typename U>
+			static void run(const storages::ArrayPtr<T*> & storage, int dim, const NumberView<U> & expr, bool stream)
+			{
+				Fill(storage.Data(), dim, T(U(expr)), stream);
+			}
+
+			template<typename U>
+			static void run(const storages::ArrayPtr<T*> & storage, int dim, const ZeroView<U> &, bool stream)
+			{
+				Fill(storage.Data(), dim, T(U(0)), stream);
+			}
+
+			// Saturating conversions of float expressions are done in blocks: source is evaluated into a buffer in L1
+			// and converted with packed instructions.
+			template<typename Arg1>
+			static void run(const storages::ArrayPtr<T*> & storage, int dim, const ConvertOp<Arg1, T> & expr, bool stream)
+			{
+				using S = typename Arg1::type;
+				const Rounding rounding = expr.GetRounding();
+				if (!ConvertKernel<S, T>::supported || !expr.Saturate() || stream ||
+					(rounding != Rounding::Nearest && rounding != Rounding::Truncate))
+				{
+					run<ConvertOp<Arg1, T>>(storage, dim, expr, stream); // element by element
+					return;
+				}
+				T * dst = storage.Data();
+				const int block = 256;
+				S buf[block];
+				for (int b = 0; b < dim; b += block)
+				{
+					const int n = dim - b < block ? dim - b : block;
+					for (int i = 0; i < n; ++i)
+						buf[i] = expr.Source().Evaluate(b + i);
+					ConvertKernel<S, T>::run(buf, dst + b, n, rounding);
+				}
+			}
+		};
+
+		// Compound assignments, each combines current coordinate with coordinate of expression
+		struct AddAssign
+		{
+			template<typename T, typename U>
+			static T run(const T & a, const U & b) { return T(a + b); }
+		};
+		struct SubAssign
+		{
+			template<typename T, typename U>
+			static T run(const T & a, const U & b) { return T(a - b); }
+		};
+		struct MulAssign
+		{
+			template<typename T, typename U>
+			static T run(const T & a, const U & b) { return T(a * b); }
+		};
+		struct DivAssign
+		{
+			template<typename T, typename U>
+			static T run(const T & a, const U & b) { return T(a / b); }
+		};
+
+		// Updates storage in place with values of expression: storage[i] = Op(storage[i], expr[i]).
+		// Destination is not a leaf of expression, so every coordinate is loaded and stored once.
+		template<typename Storage>
+		struct Updater
+		{
+			template<typename Op, typename Expr>
+			static void run(const Storage & storage, int dim, const Expr & expr)
+			{
+				using T = typename Storage::ElementType;
+				for (int i = 0; i < dim; ++i)
+				{
+					const T cur = storage[i];
+					storage[i] = Op::run(cur, expr.Evaluate(i));
+				}
+			}
+		};
+
+		template<typename T>
+		struct Updater<storages::ArrayPtr<T*>>
+		{
+			template<typename Op, typename Expr>
+			static void run(const storages::ArrayPtr<T*> & storage, int dim, const Expr & expr)
+			{
+				T * const dst = storage.Data();
+				for (int i = 0; i < dim; ++i)
+					dst[i] = Op::run(dst[i], expr.Evaluate(i));
+			}
+		};
+
+		// Right side of compound assignment: expressions as they are, scalars as Number views
+		template<typename Expr>
+		inline typename std::enable_if<IsExpression<Expr>::value, const Expr &>::type Operand(const Expr & expr) { return expr; }
+		template<typename Expr>
+		inline typename std::enable_if<!IsExpression<Expr>::value, NumberView<Expr>>::type Operand(const Expr & num) { return NumberView<Expr>(num); }
+
+		template<typename Storage>
+		class AssignableVectorView
+		{
+			const int dim;
+			const Storage storage;
+		public:
+			using type = typename Storage::ElementType;
+			AssignableVectorView(Storage storage, int dim) : dim(dim), storage(std::move(storage)) {}
+			type Evaluate(int i) const { return storage[i]; }
+			int Dim() const { return dim; }
+			type operator[](int i) const { return storage[i]; }
+			const Storage & GetStorage() const { return storage; }
+
+			template<typename Expr>
+			AssignableVectorView<Storage> & operator=(const Expr & expr)
+			{
+				Assign(expr, false);
+				return *this;
+			}
+
+			// Evaluates expression into the storage. If stream is true, non-temporal stores are used where storage supports them.
+			template<typename Expr>
+			void Assign(const Expr & expr, bool stream) const
+			{
+				Assigner<Storage>::run(storage, dim, expr, stream);
+			}
+
+			// In place updates, expression may be a vector expression or a scalar
+			template<typename Expr>
+			AssignableVectorView<Storage> & operator+=(const Expr & expr)
+			{
+				Updater<Storage>::template run<AddAssign>(storage, dim, Operand(expr));
+				return *this;
+			}
+			template<typename Expr>
+			AssignableVectorView<Storage> & operator-=(const Expr & expr)
+			{
+				Updater<Storage>::template run<SubAssign>(storage, dim, Operand(expr));
+				return *this;
+			}
+			template<typename Expr>
+			AssignableVectorView<Storage> & operator*=(const Expr & expr)
+			{
+				Updater<Storage>::template run<MulAssign>(storage, dim, Operand(expr));
+				return *this;
+			}
+			template<typename Expr>
+			AssignableVectorView<Storage> & operator/=(const Expr & expr)
+			{
+				Updater<Storage>::template run<DivAssign>(storage, dim, Operand(expr));
+				return *this;
+			}
+		};
+
+		// Assignable view that writes with non-temporal stores regardless of size. Created by Stream(...).
+		template<typename Storage>
+		class StreamedVectorView
+		{
+			const AssignableVectorView<Storage> & view;
+		public:
+			StreamedVectorView(const AssignableVectorView<Storage> & view) : view(view) {}
+
+			template<typename Expr>
+			StreamedVectorView<Storage> & operator=(const Expr & expr)
+			{
+				view.Assign(expr, true);
+				return *this;
+			}
+		};
+
+		// View of rows x cols matrix stored row by row, ld is distance between starts of consecutive rows.
+		// Rows and columns are ordinary vector views. Support const T* and T* cases.
+		template<typename Ptr>
+		class MatrixView
+		{
+			const Ptr ptr;
+			const int rows, cols, ld;
+		public:
+			using type = typename std::remove_const<typename std::remove_pointer<Ptr>::type>::type;
+			MatrixView(Ptr ptr, int rows, int cols, int ld) : ptr(ptr), rows(rows), cols(cols), ld(ld) {}
+			int Rows() const { return rows; }
+			int Cols() const { return cols; }
+			int Stride() const { return ld; }
+			Ptr Data() const { return ptr; }
+			Ptr RowPtr(int i) const { return ptr + i * ld; }
+			type Evaluate(int i, int j) const { return ptr[i * ld + j]; }
+
+			VectorView<storages::ArrayPtr<const type*>> Row(int i) const { return{ { ptr + i * ld }, cols }; }
+			VectorView<storages::StridedArrayPtr<const type*>> Col(int j) const { return{ { ptr + j, ld }, rows }; }
+			AssignableVectorView<storages::ArrayPtr<Ptr>> ARow(int i) const { return{ { ptr + i * ld }, cols }; }
+			AssignableVectorView<storages::StridedArrayPtr<Ptr>> ACol(int j) const { return{ { ptr + j, ld }, rows }; }
+
+			// Matrix expressions are evaluated row by row so that writes are contiguous
+			template<typename Expr>
+			MatrixView<Ptr> & operator=(const Expr & expr)
+			{
+				for (int i = 0; i < rows; ++i)
+				{
+					const Ptr r = ptr + i * ld;
+					for (int j = 0; j < cols; ++j)
+						r[j] = expr.Evaluate(i, j);
+				}
+				return *this;
+			}
+
+			template<typename Expr>
+			MatrixView<Ptr> & operator+=(const Expr & expr)
+			{
+				for (int i = 0; i < rows; ++i)
+				{
+					const Ptr r = ptr + i * ld;
+					for (int j = 0; j < cols; ++j)
+						r[j] += expr.Evaluate(i, j);
+				}
+				return *this;
+			}
+
+			template<typename Expr>
+			MatrixView<Ptr> & operator-=(const Expr & expr)
+			{
+				for (int i = 0; i < rows; ++i)
+				{
+					const Ptr r = ptr + i * ld;
+					for (int j = 0; j < cols; ++j)
+						r[j] -= expr.Evaluate(i, j);
+				}
+				return *this;
+			}
+		};
+
+		// Matrix expression v1 * v2^T
+		template<typename Arg1, typename Arg2>
+		class OuterProd
+		{
+			const Arg1 & v1;
+			const Arg2 & v2;
+		public:
+			using type = decltype(std::declval<typename Arg1::type>() * std::declval<typename Arg2::type>());
+			OuterProd(const Arg1 & v1, const Arg2 & v2) : v1(v1), v2(v2) {}
+			type Evaluate(int i, int j) const { return v1.Evaluate(i) * v2.Evaluate(j); }
+			int Rows() const { return v1.Dim(); }
+			int Cols() const { return v2.Dim(); }
+		};
+
+		// Matrix expression with vector v in every row: m(i, j) = v(j)
+		template<typename Arg1>
+		class RowBroadcast
+		{
+			const Arg1 & v;
+		public:
+			using type = typename Arg1::type;
+			RowBroadcast(const Arg1 & v) : v(v) {}
+			type Evaluate(int, int j) const { return v.Evaluate(j); }
+		};
+
+		// Matrix expression with vector v in every column: m(i, j) = v(i)
+		template<typename Arg1>
+		class ColBroadcast
+		{
+			const Arg1 & v;
+		public:
+			using type = typename Arg1::type;
+			ColBroadcast(const Arg1 & v) : v(v) {}
+			type Evaluate(int i, int) const { return v.Evaluate(i); }
+		};
+
+		// Element of matrix operand, Number views act as matrices of the same number
+		template<typename T>
+		inline T MatrixElement(const NumberView<T> & num, int, int) { return num; }
+		template<typename Arg>
+		inline typename std::enable_if<IsMatrixExpression<Arg>::value, typename Arg::type>::type MatrixElement(const Arg & m, int i, int j)
+		{
+			return m.Evaluate(i, j);
+		}
+
+		template<typename Arg1, typename Arg2>
+		struct MatrixAdd
+		{
+			using type = decltype(MatrixElement(std::declval<Arg1>(), 0, 0) + MatrixElement(std::declval<Arg2>(), 0, 0));
+			static type run(int i, int j, const Arg1 & m1, const Arg2 & m2)
+			{
+				return MatrixElement(m1, i, j) + MatrixElement(m2, i, j);
+			}
+		};
+
+		template<typename Arg1, typename Arg2>
+		struct MatrixSub
+		{
+			using type = decltype(MatrixElement(std::declval<Arg1>(), 0, 0) - MatrixElement(std::declval<Arg2>(), 0, 0));
+			static type run(int i, int j, const Arg1 & m1, const Arg2 & m2)
+			{
+				return MatrixElement(m1, i, j) - MatrixElement(m2, i, j);
+			}
+		};
+
+		template<typename Arg1, typename Arg2>
+		struct MatrixMul
+		{
+			using type = decltype(MatrixElement(std::declval<Arg1>(), 0, 0) * MatrixElement(std::declval<Arg2>(), 0, 0));
+			static type run(int i, int j, const Arg1 & m1, const Arg2 & m2)
+			{
+				return MatrixElement(m1, i, j) * MatrixElement(m2, i, j);
+			}
+		};
+
+		template<typename Arg1, typename Arg2>
+		struct MatrixDiv
+		{
+			using type = decltype(MatrixElement(std::declval<Arg1>(), 0, 0) / MatrixElement(std::declval<Arg2>(), 0, 0));
+			static type run(int i, int j, const Arg1 & m1, const Arg2 & m2)
+			{
+				return MatrixElement(m1, i, j) / MatrixElement(m2, i, j);
+			}
+		};
+
+		// Element-wise operation on matrix expressions, evaluated by assignment to matrix view in one pass row by row
+		template<template <typename, typename> class Op, typename Arg1, typename Arg2>
+		class MatrixBinOp
+		{
+			const Arg1 & m1;
+			const Arg2 & m2;
+		public:
+			using type = typename Op<Arg1, Arg2>::type;
+			MatrixBinOp(const Arg1 & m1, const Arg2 & m2) : m1(m1), m2(m2) {}
+			type Evaluate(int i, int j) const { return Op<Arg1, Arg2>::run(i, j, m1, m2); }
+		};
+
+		inline int ThreadCount()
+		{
+			const int hw = int(std::thread::hardware_concurrency());
+			const int n = VEVI_MAX_THREADS > 0 ? VEVI_MAX_THREADS : hw;
+			return n > 0 ? n : 1;
+		}
+
+		// Number of threads ParallelFor uses for range [0, n) split in chunks of grain
+		inline int ParallelThreads(int n, int grain)
+		{
+			const int chunks = (n + grain - 1) / grain;
+			const int threads = ThreadCount();
+			return chunks < threads ? (chunks > 0 ? chunks : 1) : threads;
+		}
+
+		// Calls fn(begin, end, thread) for chunks of [0, n) of size grain. Chunks are handed out dynamically
+		// so uneven work is balanced. thread is in [0, ParallelThreads(n, grain)) and can index per thread accumulators.
+		template<typename Fn>
+		inline void ParallelFor(int n, int grain, const Fn & fn)
+		{
+			const int chunks = (n + grain - 1) / grain;
+			const int threads = ParallelThreads(n, grain);
+			if (threads <= 1)
+			{
+				if (n > 0) fn(0, n, 0);
+				return;
+			}
+			std::atomic<int> next(0);
+			auto worker = [&](int t)
+			{
+				for (int c = next++; c < chunks; c = next++)
+					fn(c * grain, (c + 1) * grain < n ? (c + 1) * grain : n, t);
+			};
+			std::vector<std::thread> pool;
+			for (int t = 1; t < threads; ++t)
+				pool.emplace_back(worker, t);
+			worker(0);
+			for (auto & th : pool)
+				th.join();
+		}
+
+		// Dot product of contiguous arrays accumulated in Acc. Independent accumulators hide latency of additions.
+		template<typename Acc, typename T1, typename T2>
+		inline Acc DotKernel(const T1 * a, const T2 * b, int dim)
+		{
+			Acc s0 = Acc(0), s1 = Acc(0), s2 = Acc(0), s3 = Acc(0);
+			int i = 0;
+			for (; i + 4 <= dim; i += 4)
+			{
+				s0 += Acc(a[i]) * Acc(b[i]);
+				s1 += Acc(a[i + 1]) * Acc(b[i + 1]);
+				s2 += Acc(a[i + 2]) * Acc(b[i + 2]);
+				s3 += Acc(a[i + 3]) * Acc(b[i + 3]);
+			}
+			for (; i < dim; ++i)
+				s0 += Acc(a[i]) * Acc(b[i]);
+			return (s0 + s1) + (s2 + s3);
+		}
+
+		// Calls fn(i, j, dot) for dot products of rows [ib, ie) of a with rows [jb, je) of b, GEMM-style:
+		// four rows of a are processed together so that every load of b row is used four times.
+		template<typename Acc, typename PtrA, typename PtrB, typename Fn>
+		inline void DotTile(const MatrixView<PtrA> & a, int ib, int ie, const MatrixView<PtrB> & b, int jb, int je, const Fn & fn)
+		{
+			const int d = a.Cols();
+			int i = ib;
+			for (; i + 4 <= ie; i += 4)
+			{
+				const PtrA a0 = a.RowPtr(i), a1 = a.RowPtr(i + 1), a2 = a.RowPtr(i + 2), a3 = a.RowPtr(i + 3);
+				for (int j = jb; j < je; ++j)
+				{
+					const PtrB y = b.RowPtr(j);
+					Acc s0 = Acc(0), s1 = Acc(0), s2 = Acc(0), s3 = Acc(0);
+					for (int p = 0; p < d; ++p)
+					{
+						const Acc yp = Acc(y[p]);
+						s0 += Acc(a0[p]) * yp;
+						s1 += Acc(a1[p]) * yp;
+						s2 += Acc(a2[p]) * yp;
+						s3 += Acc(a3[p]) * yp;
+					}
+					fn(i, j, s0);
+					fn(i + 1, j, s1);
+					fn(i + 2, j, s2);
+					fn(i + 3, j, s3);
+				}
+			}
+			for (; i < ie; ++i)
+				for (int j = jb; j < je; ++j)
+					fn(i, j, DotKernel<Acc>(a.RowPtr(i), b.RowPtr(j), d));
+		}
+
+		// If first argument has Dim then use it, otherwise use Dim of the second argument.
+		// If there is no Dim of the second argument there will be compilation error 
+		// meaning that vector operation can not be performed because dimentionality is not known
+		template<typename Arg1, typename Arg2>
+		struct Dimention
+		{
+			template<typename U = Arg1>
+			static typename std::enable_if<HasMemberDim<U>::value, int>::type Dim(const Arg1 & a1, const Arg2 & a2)
+			{
+				return a1.Dim();
+			}
+
+			template<typename U = Arg1>
+			static typename std::enable_if<!HasMemberDim<U>::value, int>::type Dim(const Arg1 & a1, const Arg2 & a2)
+			{
+				return a2.Dim();
+			}
+		};
+
+		// Vector that owns its coordinates, so it can hold results of expressions. Dimentions up to N need no allocation,
+		// shrinking keeps the buffer and assignment evaluates expression right into it.
+		template<typename T, int N = 16>
+		class OwnedVector
+		{
+			int dim;
+			storages::SmallBufferArray<T, N> storage;
+
+			template<typename Expr>
+			typename std::enable_if<HasMemberDim<Expr>::value, int>::type DimOf(const Expr & expr) const { return expr.Dim(); }
+			template<typename Expr>
+			typename std::enable_if<!HasMemberDim<Expr>::value, int>::type DimOf(const Expr &) const { return dim; }
+		public:
+			using type = T;
+			explicit OwnedVector(int dim = 0) : dim(dim), storage(dim) {}
+			OwnedVector(const OwnedVector<T, N> & v) : dim(v.dim), storage(v.dim)
+			{
+				for (int i = 0; i < dim; ++i) storage[i] = v.storage[i];
+			}
+			OwnedVector(OwnedVector<T, N> && v) : dim(v.dim), storage(std::move(v.storage))
+			{
+				v.dim = 0;
+			}
+			OwnedVector<T, N> & operator=(const OwnedVector<T, N> & v)
+			{
+				if (this != &v)
+				{
+					storage.Reserve(v.dim, 0);
+					dim = v.dim;
+					for (int i = 0; i < dim; ++i) storage[i] = v.storage[i];
+				}
+				return *this;
+			}
+			OwnedVector<T, N> & operator=(OwnedVector<T, N> && v)
+			{
+				storage = std::move(v.storage);
+				dim = v.dim;
+				v.dim = 0;
+				return *this;
+			}
+
+			// Expressions with dimention resize the vector. If buffer has to grow, expression is evaluated into the new one,
+			// so it may read this vector.
+			template<typename Expr>
+			OwnedVector<T, N> & operator=(const Expr & expr)
+			{
+				const int n = DimOf(expr);
+				if (n > storage.Capacity())
+				{
+					storages::SmallBufferArray<T, N> fresh(n);
+					Assigner<storages::ArrayPtr<T*>>::run(fresh.Data(), n, expr, false);
+					storage = std::move(fresh);
+				}
+				else
+					Assigner<storages::ArrayPtr<T*>>::run(storage.Data(), n, expr, false);
+				dim = n;
+				return *this;
+			}
+
+			// In place updates of current dim coordinates, expression may be a vector expression or a scalar
+			template<typename Expr>
+			OwnedVector<T, N> & operator+=(const Expr & expr)
+			{
+				Updater<storages::ArrayPtr<T*>>::template run<AddAssign>(storage.Data(), dim, Operand(expr));
+				return *this;
+			}
+			template<typename Expr>
+			OwnedVector<T, N> & operator-=(const Expr & expr)
+			{
+				Updater<storages::ArrayPtr<T*>>::template run<SubAssign>(storage.Data(), dim, Operand(expr));
+				return *this;
+			}
+			template<typename Expr>
+			OwnedVector<T, N> & operator*=(const Expr & expr)
+			{
+				Updater<storages::ArrayPtr<T*>>::template run<MulAssign>(storage.Data(), dim, Operand(expr));
+				return *this;
+			}
+			template<typename Expr>
+			OwnedVector<T, N> & operator/=(const Expr & expr)
+			{
+				Updater<storages::ArrayPtr<T*>>::template run<DivAssign>(storage.Data(), dim, Operand(expr));
+				return *this;
+			}
+
+			type Evaluate(int i) const { return storage[i]; }
+			int Dim() const { return dim; }
+			T & operator[](int i) { return storage[i]; }
+			const T & operator[](int i) const { return storage[i]; }
+			T * Data() const { return storage.Data(); }
+			int Capacity() const { return storage.Capacity(); }
+
+			// Changes dimention keeping coordinates that fit, reallocates only when growing beyond capacity
+			void Resize(int n)
+			{
+				storage.Reserve(n, dim < n ? dim : n);
+				dim = n;
+			}
+		};
+
+		// Reduction of at(begin), ..., at(end - 1) with associative combine. Four independent accumulators
+		// hide latency of combine, so identity has to be neutral and order of combining is not left to right.
+		template<typename T, typename Combine, typename At>
+		inline T ReduceRange(const Combine & combine, const T & identity, int begin, int end, const At & at)
+		{
+			T a0 = identity, a1 = identity, a2 = identity, a3 = identity;
+			int i = begin;
+			// Types narrower than int are combined in one accumulator: GCC 12 vectorizes four of them
+			// wrongly, and the vectorized single one hides latency anyway
+			if (sizeof(T) >= sizeof(int))
+				for (; i + 4 <= end; i += 4)
+				{
+					a0 = combine(a0, T(at(i)));
+					a1 = combine(a1, T(at(i + 1)));
+					a2 = combine(a2, T(at(i + 2)));
+					a3 = combine(a3, T(at(i + 3)));
+				}
+			for (; i < end; ++i)
+				a0 = combine(a0, T(at(i)));
+			return combine(combine(a0, a1), combine(a2, a3));
+		}
+
+		template<typename Arg1, typename Arg2>
+		struct VectorAdd
+		{
+			using type = decltype(Arg1::type() + Arg2::type());
+			static type run(int i, const Arg1 & v1, const Arg2 & v2)
+			{
+				return v1.Evaluate(i) + v2.Evaluate(i);
+			}
+		};
+
+		template<typename Arg1, typename Arg2>
+		struct VectorSub
+		{
+			using type = decltype(Arg1::type() - Arg2::type());
+			static type run(int i, const Arg1 & v1, const Arg2 & v2)
+			{
+				return v1.Evaluate(i) - v2.Evaluate(i);
+			}
+		};
+
+		template<typename Arg1, typename Arg2>
+		struct VectorMul
+		{
+			using type = decltype(Arg1::type() * Arg2::type());
+			static type run(int i, const Arg1 & v1, const Arg2 & v2)
+			{
+				return v1.Evaluate(i) * v2.Evaluate(i);
+			}
+		};
+
+		template<typename Arg1, typename Arg2>
+		struct VectorDiv
+		{
+			using type = decltype(Arg1::type() / Arg2::type());
+			static type run(int i, const Arg1 & v1, const Arg2 & v2)
+			{
+				return v1.Evaluate(i) / v2.Evaluate(i);
+			}
+		};
+
+		template<typename Arg1, typename Arg2>
+		struct DotProd
+		{
+			using type = decltype(Arg1::type() * Arg2::type());
+			static type run(const Arg1 & d1, const Arg2 & d2)
+			{
+				const int dim = Dimention<Arg1, Arg2>::Dim(d1, d2);
+				if (!BlockDecoded<Arg1>::value && !BlockDecoded<Arg2>::value)
+					return ReduceRange(Plus(), type(0), 0, dim, [&](int i) { return d1.Evaluate(i) * d2.Evaluate(i); });
+				// Products of coordinate i of every block are added up in sum[i], a buffer in L1, so blocks are
+				// elementwise loops that compilers vectorize and the buffer is reduced once at the end
+				BlockTree<Arg1> t1(d1);
+				BlockTree<Arg2> t2(d2);
+				type sum[DecodeBlock];
+				for (int i = 0; i < DecodeBlock; ++i) sum[i] = type(0);
+				for (int b = 0; b < dim; b += DecodeBlock)
+				{
+					t1.Load(b);
+					t2.Load(b);
+					if (dim - b >= DecodeBlock)
+						for (int i = 0; i < DecodeBlock; ++i) sum[i] += t1.Evaluate(b + i) * t2.Evaluate(b + i);
+					else
+						for (int i = 0; i < dim - b; ++i) sum[i] += t1.Evaluate(b + i) * t2.Evaluate(b + i);
+				}
+				return ReduceRange(Plus(), type(0), 0, DecodeBlock, [&](int i) { return sum[i]; });
+			}
+		};
+
+		template<typename Arg1>
+		struct VectorSum
+		{
+			using type = typename Arg1::type;
+			static type run(const Arg1 & v)
+			{
+				return ReduceRange(Plus(), type(0), 0, v.Dim(), [&](int i) { return v.Evaluate(i); });
+			}
+		};
+
+		template<typename Arg1>
+		struct VectorNeg
+		{
+			using type = decltype(-Arg1::type());
+			static type run(int i, const Arg1 & v1)
+			{
+				return -v1.Evaluate(i);
+			}
+		};
+
+		template<typename Arg1, typename TargetType>
+		struct VectorCast
+		{
+			using type = TargetType;
+			static type run(int i, const Arg1 & v1)
+			{
+				return (type)v1.Evaluate(i);
+			}
+		};
+
+		template<typename Arg>
+		inline typename std::enable_if<HasMemberDim<Arg>::value>::type AssertDim3(const Arg & v)
+		{
+			assert(v.Dim() == 3 && "Cross product is defined for 3 dimentional vectors only");
+			(void)v;
+		}
+		template<typename Arg>
+		inline typename std::enable_if<!HasMemberDim<Arg>::value>::type AssertDim3(const Arg &) {}
+
+		// Coordinate of cross product of two 3 dimentional vectors
+		template<typename Arg1, typename Arg2>
+		struct VectorCross
+		{
+			using type = decltype(std::declval<typename Arg1::type>() * std::declval<typename Arg2::type>());
+			static type run(int i, const Arg1 & v1, const Arg2 & v2)
+			{
+				const int j = i == 2 ? 0 : i + 1;
+				const int k = j == 2 ? 0 : j + 1;
+				return v1.Evaluate(j) * v2.Evaluate(k) - v1.Evaluate(k) * v2.Evaluate(j);
+			}
+		};
+
+		// Cross product evaluated when it is created, so it may be assigned to one of its operands:
+		// AVec(v, 3) = Cross(Vec(v, 3), Vec(w)) reads v before writing it
+		template<typename T>
+		class CrossView
+		{
+			T c[3];
+		public:
+			using type = T;
+			template<typename Arg1, typename Arg2>
+			CrossView(const Arg1 & v1, const Arg2 & v2)
+			{
+				for (int i = 0; i < 3; ++i)
+					c[i] = VectorCross<Arg1, Arg2>::run(i, v1, v2);
+			}
+			type Evaluate(int i) const { return c[i]; }
+			int Dim() const { return 3; }
+		};
+
+		// Batched operations on multi-component vectors: every coordinate is a small vector (Point) and operation is applied
+		// to each of them independently. The assignment loop runs across elements, so with SoA storages every component
+		// is a contiguous stream and the loop vectorizes across elements rather than within one small vector.
+		template<typename Arg1, typename Arg2>
+		struct PointDot
+		{
+			using type = typename Arg1::type::ScalarType;
+			static type run(int i, const Arg1 & v1, const Arg2 & v2)
+			{
+				const typename Arg1::type a = v1.Evaluate(i);
+				const typename Arg2::type b = v2.Evaluate(i);
+				type res = a[0] * b[0];
+				for (int k = 1; k < Arg1::type::size; ++k)
+					res += a[k] * b[k];
+				return res;
+			}
+		};
+
+		template<typename Arg1, typename Arg2>
+		struct PointCross
+		{
+			using type = typename Arg1::type;
+			static_assert(type::size == 3, "Cross product is defined for 3 component vectors only");
+			static type run(int i, const Arg1 & v1, const Arg2 & v2)
+			{
+				const type a = v1.Evaluate(i);
+				const type b = v2.Evaluate(i);
+				type r;
+				r[0] = a[1] * b[2] - a[2] * b[1];
+				r[1] = a[2] * b[0] - a[0] * b[2];
+				r[2] = a[0] * b[1] - a[1] * b[0];
+				return r;
+			}
+		};
+
+		template<typename Arg1>
+		struct PointNorm
+		{
+			using type = typename Arg1::type::ScalarType;
+			static type run(int i, const Arg1 & v1)
+			{
+				const typename Arg1::type a = v1.Evaluate(i);
+				type res = a[0] * a[0];
+				for (int k = 1; k < Arg1::type::size; ++k)
+					res += a[k] * a[k];
+				return type(std::sqrt(res));
+			}
+		};
+
+		// Zero vectors are left as they are
+		template<typename Arg1>
+		struct PointNormalize
+		{
+			using type = typename Arg1::type;
+			static type run(int i, const Arg1 & v1)
+			{
+				type a = v1.Evaluate(i);
+				typename type::ScalarType sq = a[0] * a[0];
+				for (int k = 1; k < type::size; ++k)
+					sq += a[k] * a[k];
+				if (sq > 0)
+				{
+					const typename type::ScalarType inv = typename type::ScalarType(1 / std::sqrt(sq));
+					for (int k = 0; k < type::size; ++k)
+						a[k] *= inv;
+				}
+				return a;
+			}
+		};
+
+		template<template <typename, typename, typename...> class Op, typename Arg1, typename Arg2, typename ...Args>
+		class BinOp
+		{
+			const Arg1 & v1;
+			const Arg2 & v2;
+		public:
+			using type = typename Op<Arg1, Arg2, Args...>::type;
+			BinOp(const Arg1 & v1, const Arg2 & v2) : v1(v1), v2(v2) {}
+			type Evaluate(int i) const { return Op<Arg1, Arg2, Args...>::run(i, v1, v2); }
+			const Arg1 & Left() const { return v1; }
+			const Arg2 & Right() const { return v2; }
+
+			template<typename U = Arg1, typename V = Arg2>
+			typename std::enable_if<HasMemberDim<U>::value || HasMemberDim<V>::value, int>::type
+				Dim() const { return details::Dimention<U, V>::Dim(v1, v2); }
+		};
+
+		template<template <typename, typename...> class Op, typename Arg1, typename ... Args >
+		class UnaOp
+		{
+			const Arg1 & v;
+		public:
+			using type = typename Op<Arg1, Args...>::type;
+			UnaOp(const Arg1 & v) : v(v) {}
+			type Evaluate(int i) const { return Op<Arg1, Args...>::run(i, v); }
+			const Arg1 & Arg() const { return v; }
+
+			template<typename U = Arg1>
+			typename std::enable_if<HasMemberDim<U>::value, int>::type
+				Dim() const { return v.Dim(); }
+		};
+
+		template<template <typename, typename, typename...> class Op, typename Arg1, typename Arg2, typename ...Args>
+		struct BlockDecoded<BinOp<Op, Arg1, Arg2, Args...>>
+		{
+			static bool const value = BlockDecoded<Arg1>::value || BlockDecoded<Arg2>::value;
+		};
+		template<template <typename, typename...> class Op, typename Arg1, typename ...Args>
+		struct BlockDecoded<UnaOp<Op, Arg1, Args...>>
+		{
+			static bool const value = BlockDecoded<Arg1>::value;
+		};
+
+		template<template <typename, typename, typename...> class Op, typename Arg1, typename Arg2, typename ...Args>
+		class BlockTree<BinOp<Op, Arg1, Arg2, Args...>, true>
+		{
+			BlockTree<Arg1> v1;
+			BlockTree<Arg2> v2;
+		public:
+			using type = typename Op<BlockTree<Arg1>, BlockTree<Arg2>, Args...>::type;
+			BlockTree(const BinOp<Op, Arg1, Arg2, Args...> & e) : v1(e.Left()), v2(e.Right()) {}
+			void Load(int b) { v1.Load(b); v2.Load(b); }
+			type Evaluate(int i) const { return Op<BlockTree<Arg1>, BlockTree<Arg2>, Args...>::run(i, v1, v2); }
+		};
+
+		template<template <typename, typename...> class Op, typename Arg1, typename ...Args>
+		class BlockTree<UnaOp<Op, Arg1, Args...>, true>
+		{
+			BlockTree<Arg1> v;
+		public:
+			using type = typename Op<BlockTree<Arg1>, Args...>::type;
+			BlockTree(const UnaOp<Op, Arg1, Args...> & e) : v(e.Arg()) {}
+			void Load(int b) { v.Load(b); }
+			type Evaluate(int i) const { return Op<BlockTree<Arg1>, Args...>::run(i, v); }
+		};
+
+		template<int... I>
+		struct Indices {};
+		template<int N, int... I>
+		struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+		template<int... I>
+		struct MakeIndices<0, I...> { using type = Indices<I...>; };
+
+		template<typename... Args>
+		struct AnyHasDim { static bool const value = false; };
+		template<typename Arg1, typename... Args>
+		struct AnyHasDim<Arg1, Args...> { static bool const value = HasMemberDim<Arg1>::value || AnyHasDim<Args...>::value; };
+
+		// Dim of the first argument that has it
+		template<typename Arg1, typename... Args>
+		inline typename std::enable_if<HasMemberDim<Arg1>::value, int>::type FirstDim(const Arg1 & v, const Args &...) { return v.Dim(); }
+		template<typename Arg1, typename... Args>
+		inline typename std::enable_if<!HasMemberDim<Arg1>::value, int>::type FirstDim(const Arg1 &, const Args &... args) { return FirstDim(args...); }
+
+		// Element-wise application of user function: coordinate i is f(args[i]...). Function is inlined into
+		// the assignment loop like built-in operations.
+		template<typename F, typename... Args>
+		class MapOp
+		{
+			const F f;
+			const std::tuple<const Args &...> args;
+		public:
+			using type = decltype(std::declval<const F &>()(std::declval<typename Args::type>()...));
+		private:
+			template<int... I>
+			type Apply(int i, Indices<I...>) const { return f(std::get<I>(args).Evaluate(i)...); }
+			template<int... I>
+			int DimOf(Indices<I...>) const { return FirstDim(std::get<I>(args)...); }
+		public:
+			MapOp(const F & f, const Args &... args) : f(f), args(args...) {}
+			type Evaluate(int i) const { return Apply(i, typename MakeIndices<sizeof...(Args)>::type()); }
+
+			template<typename U = F>
+			typename std::enable_if<AnyHasDim<Args...>::value && std::is_same<U, F>::value, int>::type
+				Dim() const { return DimOf(typename MakeIndices<sizeof...(Args)>::type()); }
+		};
+
+	}
+
+	// Assignable Vector
+	template<typename T>
+	inline details::AssignableVectorView<details::storages::ArrayPtr<T*>> AVec(T * ptr, int dim)
+	{
+		return{ { ptr }, dim };
+	}
+	template<typename T>
+	inline details::AssignableVectorView<details::storages::StridedArrayPtr<T*>> AVec(T * ptr, int dim, int stride)
+	{
+		return{ { ptr, stride }, dim };
+	}
+	// Vector that owns storage for dim coordinates
+	template<typename T>
+	inline details::OwnedVector<T> AVec(int dim)
+	{
+		return details::OwnedVector<T>(dim);
+	}
+
+	// Assignable Vector that is written with non-temporal stores, i.e. Stream(AVec(ptr, dim)) = expr
+	template<typename Storage>
+	inline details::StreamedVectorView<Storage> Stream(const details::AssignableVectorView<Storage> & v)
+	{
+		return details::StreamedVectorView<Storage>(v);
+	}
+
+	// Const Vector
+	template<typename T>
+	inline details::VectorView<details::storages::ArrayPtr<const T*>> Vec(const T * ptr, int dim)
+	{
+		return{ { ptr }, dim };
+	}
+	template<typename T>
+	inline details::VectorView<details::storages::StridedArrayPtr<const T*>> Vec(const T * ptr, int dim, int stride)
+	{
 		return{ { ptr, stride }, dim };
 	}
+
+	// Const Vector without dimention
+	template<typename T>
+	inline details::NoDimVectorView<details::storages::ArrayPtr<const T*>> Vec(const T * ptr)
+	{
+		return{ { ptr } };
+	}
+	//template<typename T>
+	//inline details::NoDimVectorView<details::storages::StridedArrayPtr<const T*>> Vec(const T * ptr, int stride) 
+	//{ 
+	//	return {{ptr,stride}};
+	//}
+
+	// Multi-component vectors: dim elements with K components each, elements are evaluated as Points.
+	// AoS layout (interleaved components)
+	template<int K, typename T>
+	inline details::VectorView<details::storages::AosArrayPtr<const T*, K>> VecN(const T * ptr, int dim)
+	{
+		return{ { ptr }, dim };
+	}
+	template<int K, typename T>
+	inline details::NoDimVectorView<details::storages::AosArrayPtr<const T*, K>> VecN(const T * ptr)
+	{
+		return{ { ptr } };
+	}
+	template<int K, typename T>
+	inline details::AssignableVectorView<details::storages::AosArrayPtr<T*, K>> AVecN(T * ptr, int dim)
+	{
+		return{ { ptr }, dim };
+	}
+	// SoA layout, comps is array of K pointers to components
+	template<int K, typename T>
+	inline details::VectorView<details::storages::SoaArrayPtr<const T*, K>> VecNSoA(T * const * comps, int dim)
+	{
+		return{ { comps }, dim };
+	}
+	template<int K, typename T>
+	inline details::NoDimVectorView<details::storages::SoaArrayPtr<const T*, K>> VecNSoA(T * const * comps)
+	{
+		return{ { comps } };
+	}
+	template<int K, typename T>
+	inline details::AssignableVectorView<details::storages::SoaArrayPtr<T*, K>> AVecNSoA(T * const * comps, int dim)
+	{
+		return{ { comps }, dim };
+	}
+
+	template<typename T>
+	using Vec3View = details::VectorView<details::storages::AosArrayPtr<const T*, 3>>;
+
+	// Single component of multi-component vector as ordinary vector, i.e. Dot(Component(VecN<3>(p, n), 0), Vec(w))
+	template<typename Storage>
+	inline details::VectorView<typename Storage::ComponentStorage> Component(const details::VectorView<Storage> & v, int k)
+	{
+		return{ v.GetStorage().Component(k), v.Dim() };
+	}
+	template<typename Storage>
+	inline details::NoDimVectorView<typename Storage::ComponentStorage> Component(const details::NoDimVectorView<Storage> & v, int k)
+	{
+		return{ v.GetStorage().Component(k) };
+	}
+	template<typename Storage>
+	inline details::AssignableVectorView<typename Storage::ComponentStorage> Component(const details::AssignableVectorView<Storage> & v, int k)
+	{
+		return{ v.GetStorage().Component(k), v.Dim() };
+	}
+
+	// Bulk layout conversions of n K-component elements. Done in blocks that fit L1 so that
+	// every output stream is written contiguously while the input block stays in cache.
+	template<int K, typename T>
+	inline void AosToSoa(const T * aos, int n, T * const * soa)
+	{
+		const int block = 256;
+		for (int b = 0; b < n; b += block)
+		{
+			const int e = b + block < n ? b + block : n;
+			for (int k = 0; k < K; ++k)
+			{
+				T * dst = soa[k];
+				for (int i = b; i < e; ++i)
+					dst[i] = aos[i * K + k];
+			}
+		}
+	}
+	template<int K, typename T>
+	inline void SoaToAos(T const * const * soa, int n, T * aos)
+	{
+		const int block = 256;
+		for (int b = 0; b < n; b += block)
+		{
+			const int e = b + block < n ? b + block : n;
+			for (int k = 0; k < K; ++k)
+			{
+				const T * src = soa[k];
+				for (int i = b; i < e; ++i)
+					aos[i * K + k] = src[i];
+			}
+		}
+	}
+
+	// Wrap for numbers
+	template<typename T>
+	inline details::NumberView<T> Num(T num) { return details::NumberView<T>(num); }
+
+	// Neutral elements for generic code, i.e. sum starts from Zero<T>() and Zero<T>() + Vec(x) is just Vec(x)
+	template<typename T>
+	inline details::ZeroView<T> Zero() { return details::ZeroView<T>(); }
 	template<typename T>
-	inline details::AssignableVectorView<details::storages::OwnedArray<T>> AVec(int dim)
+	inline details::OneView<T> One() { return details::OneView<T>(); }
+
+	// Functions on Numbers are folded to a number
+	template<typename T>
+	inline details::NumberView<T> operator+(const details::NumberView<T> & v1, const details::NumberView<T> & v2)
 	{
-		return{ { dim }, dim };
+		return T(v1) + T(v2);
 	}
 
-	// Const Vector
 	template<typename T>
-	inline details::VectorView<details::storages::ArrayPtr<const T*>> Vec(const T * ptr, int dim)
+	inline details::NumberView<T> operator-(const details::NumberView<T> & v1, const details::NumberView<T> & v2)
 	{
-		return{ { ptr }, dim };
+		return T(v1) - T(v2);
 	}
+
 	template<typename T>
-	inline details::VectorView<details::storages::StridedArrayPtr<const T*>> Vec(const T * ptr, int dim, int stride)
+	inline details::NumberView<T> operator*(const details::NumberView<T> & v1, const details::NumberView<T> & v2)
 	{
-		return{ { ptr, stride }, dim };
+		return T(v1) * T(v2);
 	}
 
-	// Const Vector without dimention
 	template<typename T>
-	inline details::NoDimVectorView<details::storages::ArrayPtr<const T*>> Vec(const T * ptr)
+	inline details::NumberView<T> operator/(const details::NumberView<T> & v1, const details::NumberView<T> & v2)
 	{
-		return{ { ptr } };
+		return T(v1) / T(v2);
 	}
-	//template<typename T>
-	//inline details::NoDimVectorView<details::storages::StridedArrayPtr<const T*>> Vec(const T * ptr, int stride) 
-	//{ 
-	//	return {{ptr,stride}};
-	//}
 
-	// Wrap for numbers
 	template<typename T>
-	inline details::NumberView<T> Num(T num) { return details::NumberView<T>(num); }
+	inline details::NumberView<T> operator-(const details::NumberView<T> & v)
+	{
+		return -T(v);
+	}
 
-	// Functions on Numbers
-	template<typename T>
-	inline details::NumberView<T> operator+(const details::NumberView<T> & v1, const details::NumberView<T> & v2)
+	// Operations with neutral elements return the other operand itself. They are more specialized than the generic
+	// operators, so they are chosen whenever the type of result stays the same.
+	template<typename T, typename Arg2>
+	inline typename std::enable_if<details::Identity<details::VectorAdd, details::ZeroView<T>, Arg2, Arg2>::value,
+		const Arg2 &>::type operator+(const details::ZeroView<T> &, const Arg2 & v2)
 	{
-		return T(v1) + T(v2);
+		return v2;
+	}
+
+	template<typename Arg1, typename T>
+	inline typename std::enable_if<details::Identity<details::VectorAdd, Arg1, details::ZeroView<T>, Arg1>::value,
+		const Arg1 &>::type operator+(const Arg1 & v1, const details::ZeroView<T> &)
+	{
+		return v1;
+	}
+
+	template<typename Arg1, typename T>
+	inline typename std::enable_if<details::Identity<details::VectorSub, Arg1, details::ZeroView<T>, Arg1>::value,
+		const Arg1 &>::type operator-(const Arg1 & v1, const details::ZeroView<T> &)
+	{
+		return v1;
+	}
+
+	template<typename T, typename Arg2>
+	inline typename std::enable_if<details::Identity<details::VectorMul, details::OneView<T>, Arg2, Arg2>::value,
+		const Arg2 &>::type operator*(const details::OneView<T> &, const Arg2 & v2)
+	{
+		return v2;
+	}
+
+	template<typename Arg1, typename T>
+	inline typename std::enable_if<details::Identity<details::VectorMul, Arg1, details::OneView<T>, Arg1>::value,
+		const Arg1 &>::type operator*(const Arg1 & v1, const details::OneView<T> &)
+	{
+		return v1;
+	}
+
+	template<typename Arg1, typename T>
+	inline typename std::enable_if<details::Identity<details::VectorDiv, Arg1, details::OneView<T>, Arg1>::value,
+		const Arg1 &>::type operator/(const Arg1 & v1, const details::OneView<T> &)
+	{
+		return v1;
 	}
 
+	// Both operands are neutral, overloads above are equally good for them
+	template<typename T>
+	inline details::ZeroView<T> operator+(const details::ZeroView<T> &, const details::ZeroView<T> &) { return details::ZeroView<T>(); }
+	template<typename T>
+	inline details::ZeroView<T> operator-(const details::ZeroView<T> &, const details::ZeroView<T> &) { return details::ZeroView<T>(); }
+	template<typename T>
+	inline details::OneView<T> operator*(const details::OneView<T> &, const details::OneView<T> &) { return details::OneView<T>(); }
+	template<typename T>
+	inline details::OneView<T> operator/(const details::OneView<T> &, const details::OneView<T> &) { return details::OneView<T>(); }
+
 	// Bin operations
 	template<typename Arg1, typename Arg2>
-	inline details::BinOp<details::VectorAdd, Arg1, Arg2> operator+(const Arg1 & v1, const Arg2 & v2)
+	inline typename std::enable_if<details::VectorOperands<Arg1, Arg2>::value,
+		details::BinOp<details::VectorAdd, Arg1, Arg2>>::type operator+(const Arg1 & v1, const Arg2 & v2)
 	{
 		return details::BinOp<details::VectorAdd, Arg1, Arg2>(v1, v2);
 	}
 
 	template<typename Arg1, typename Arg2>
-	inline details::BinOp<details::VectorSub, Arg1, Arg2> operator-(const Arg1 & v1, const Arg2 & v2)
+	inline typename std::enable_if<details::VectorOperands<Arg1, Arg2>::value,
+		details::BinOp<details::VectorSub, Arg1, Arg2>>::type operator-(const Arg1 & v1, const Arg2 & v2)
 	{
 		return details::BinOp<details::VectorSub, Arg1, Arg2>(v1, v2);
 	}
 
+	// Coordinate-wise product and quotient, Num(a) * Vec(x) scales vector
+	template<typename Arg1, typename Arg2>
+	inline typename std::enable_if<details::VectorOperands<Arg1, Arg2>::value,
+		details::BinOp<details::VectorMul, Arg1, Arg2>>::type operator*(const Arg1 & v1, const Arg2 & v2)
+	{
+		return details::BinOp<details::VectorMul, Arg1, Arg2>(v1, v2);
+	}
+
+	template<typename Arg1, typename Arg2>
+	inline typename std::enable_if<details::VectorOperands<Arg1, Arg2>::value,
+		details::BinOp<details::VectorDiv, Arg1, Arg2>>::type operator/(const Arg1 & v1, const Arg2 & v2)
+	{
+		return details::BinOp<details::VectorDiv, Arg1, Arg2>(v1, v2);
+	}
+
 	template<typename Arg1, typename Arg2>
 	inline details::NumberView<typename details::DotProd<Arg1, Arg2>::type> Dot(const Arg1 & v1, const Arg2 & v2)
 	{
 		return details::DotProd<Arg1, Arg2>::run(v1, v2);
 	}
 
+	// Sum of coordinates
+	template<typename Arg1>
+	inline details::NumberView<typename details::VectorSum<Arg1>::type> Sum(const Arg1 & v)
+	{
+		return details::VectorSum<Arg1>::run(v);
+	}
+
+	// Reduction of coordinates of vector expression with associative combine(a, b), identity is its neutral element,
+	// i.e. Reduce(Maximum(), -FLT_MAX, Vec(x, n)) is maximum. Any associative functor or lambda works as combine,
+	// operations on single coordinates go to Map, i.e. Reduce(Plus(), 0.f, Map(f, Vec(x, n))).
+	// Several accumulators are used, so coordinates are not combined strictly left to right.
+	template<typename Combine, typename T, typename Arg1>
+	inline details::NumberView<T> Reduce(const Combine & combine, const T & identity, const Arg1 & v)
+	{
+		return details::ReduceRange(combine, identity, 0, v.Dim(), [&](int i) { return v.Evaluate(i); });
+	}
+
+	// Reduce that splits coordinates in chunks reduced by parallel threads, partial results of chunks are combined
+	// pairwise in a tree. Chunks do not depend on number of threads, so result is the same for every run.
+	template<typename Combine, typename T, typename Arg1>
+	inline details::NumberView<T> ParallelReduce(const Combine & combine, const T & identity, const Arg1 & v)
+	{
+		const int n = v.Dim(), grain = 1 << 14;
+		const int chunks = (n + grain - 1) / grain;
+		if (chunks <= 1)
+			return Reduce(combine, identity, v);
+		std::unique_ptr<T[]> partial(new T[chunks]);
+		details::ParallelFor(n, grain, [&](int begin, int end, int)
+		{
+			// Single thread gets the whole range at once
+			for (int b = begin; b < end; b += grain)
+				partial[b / grain] = details::ReduceRange(combine, identity, b, end - b < grain ? end : b + grain,
+					[&](int i) { return v.Evaluate(i); });
+		});
+		for (int step = 1; step < chunks; step *= 2)
+			for (int k = 0; k + step < chunks; k += 2 * step)
+				partial[k] = combine(partial[k], partial[k + step]);
+		return partial[0];
+	}
+
 	// Unary operations
 	template<typename Arg1>
-	inline details::UnaOp<details::VectorNeg, Arg1> operator-(const Arg1 & v)
+	inline typename std::enable_if<details::IsExpression<Arg1>::value, details::UnaOp<details::VectorNeg, Arg1>>::type
+		operator-(const Arg1 & v)
 	{
 		return details::UnaOp<details::VectorNeg, Arg1>(v);
 	}
 
+	// Double negation is removed when it does not change the type, i.e. -(-Vec(x)) is Vec(x)
+	template<typename Arg1>
+	inline typename std::enable_if<std::is_same<typename details::UnaOp<details::VectorNeg, Arg1>::type, typename Arg1::type>::value,
+		const Arg1 &>::type operator-(const details::UnaOp<details::VectorNeg, Arg1> & v)
+	{
+		return v.Arg();
+	}
+
+	// Cast to the type of expression is the expression itself
 	template<typename TargetType, typename Arg1>
-	inline details::UnaOp<details::VectorCast, Arg1, TargetType> Cast(const Arg1 & v)
+	inline typename std::enable_if<!std::is_same<TargetType, typename Arg1::type>::value,
+		details::UnaOp<details::VectorCast, Arg1, TargetType>>::type Cast(const Arg1 & v)
 	{
 		return details::UnaOp<details::VectorCast, Arg1, TargetType>(v);
 	}
 
+	template<typename TargetType, typename Arg1>
+	inline typename std::enable_if<std::is_same<TargetType, typename Arg1::type>::value, const Arg1 &>::type Cast(const Arg1 & v)
+	{
+		return v;
+	}
+
+	// Applies f to coordinates of vector expressions, i.e. AVec(y, n) = Map([](float x) { return x > 0 ? x : 0.1f * x; }, Vec(x))
+	// f takes one coordinate of every argument, scalars have to be wrapped in Num(...).
+	template<typename F, typename... Args>
+	inline details::MapOp<F, Args...> Map(const F & f, const Args &... args)
+	{
+		return details::MapOp<F, Args...>(f, args...);
+	}
+
+	// Conversion to TargetType with given rounding of floating point values. With saturate values out of range of
+	// TargetType are clamped to it, i.e. AVec(pixels, n) = Convert<std::uint8_t>(Vec(intensity) * Num(255.f))
+	template<typename TargetType, typename Arg1>
+	inline details::ConvertOp<Arg1, TargetType> Convert(const Arg1 & v, Rounding rounding = Rounding::Nearest, bool saturate = true)
+	{
+		return details::ConvertOp<Arg1, TargetType>(v, rounding, saturate);
+	}
+
+	// Matrices stored row by row. ld is distance between rows' starts, by default rows are packed.
+	template<typename T>
+	inline details::MatrixView<T*> AMat(T * ptr, int rows, int cols, int ld = 0)
+	{
+		return details::MatrixView<T*>(ptr, rows, cols, ld ? ld : cols);
+	}
+	template<typename T>
+	inline details::MatrixView<const T*> Mat(const T * ptr, int rows, int cols, int ld = 0)
+	{
+		return details::MatrixView<const T*>(ptr, rows, cols, ld ? ld : cols);
+	}
+
+	// Cross product of 3 dimentional vectors, operands with dimention are checked to have exactly 3 coordinates.
+	// All coordinates are computed here, so the result may be assigned to an operand.
+	template<typename Arg1, typename Arg2>
+	inline typename std::enable_if<details::VectorOperands<Arg1, Arg2>::value,
+		details::CrossView<typename details::VectorCross<Arg1, Arg2>::type>>::type Cross(const Arg1 & v1, const Arg2 & v2)
+	{
+		details::AssertDim3(v1);
+		details::AssertDim3(v2);
+		return details::CrossView<typename details::VectorCross<Arg1, Arg2>::type>(v1, v2);
+	}
+
+	// Matrix with vector v in every row (v is indexed by column) or in every column (v is indexed by row),
+	// i.e. AMat(x, n, d) -= RowBroadcast(Vec(mean, d)) centers rows of x
+	template<typename Arg1>
+	inline details::RowBroadcast<Arg1> RowBroadcast(const Arg1 & v)
+	{
+		return details::RowBroadcast<Arg1>(v);
+	}
+	template<typename Arg1>
+	inline details::ColBroadcast<Arg1> ColBroadcast(const Arg1 & v)
+	{
+		return details::ColBroadcast<Arg1>(v);
+	}
+
+	// Element-wise operations on matrix expressions, Num(...) is broadcast to every element
+	template<typename Arg1, typename Arg2>
+	inline typename std::enable_if<details::MatrixOperands<Arg1, Arg2>::value,
+		details::MatrixBinOp<details::MatrixAdd, Arg1, Arg2>>::type operator+(const Arg1 & m1, const Arg2 & m2)
+	{
+		return details::MatrixBinOp<details::MatrixAdd, Arg1, Arg2>(m1, m2);
+	}
+	template<typename Arg1, typename Arg2>
+	inline typename std::enable_if<details::MatrixOperands<Arg1, Arg2>::value,
+		details::MatrixBinOp<details::MatrixSub, Arg1, Arg2>>::type operator-(const Arg1 & m1, const Arg2 & m2)
+	{
+		return details::MatrixBinOp<details::MatrixSub, Arg1, Arg2>(m1, m2);
+	}
+	template<typename Arg1, typename Arg2>
+	inline typename std::enable_if<details::MatrixOperands<Arg1, Arg2>::value,
+		details::MatrixBinOp<details::MatrixMul, Arg1, Arg2>>::type operator*(const Arg1 & m1, const Arg2 & m2)
+	{
+		return details::MatrixBinOp<details::MatrixMul, Arg1, Arg2>(m1, m2);
+	}
+	template<typename Arg1, typename Arg2>
+	inline typename std::enable_if<details::MatrixOperands<Arg1, Arg2>::value,
+		details::MatrixBinOp<details::MatrixDiv, Arg1, Arg2>>::type operator/(const Arg1 & m1, const Arg2 & m2)
+	{
+		return details::MatrixBinOp<details::MatrixDiv, Arg1, Arg2>(m1, m2);
+	}
+
+	// Outer product, i.e. AMat(m, 3, 2) = Outer(Vec(x, 3), Vec(y, 2))
+	template<typename Arg1, typename Arg2>
+	inline details::OuterProd<Arg1, Arg2> Outer(const Arg1 & v1, const Arg2 & v2)
+	{
+		return details::OuterProd<Arg1, Arg2>(v1, v2);
+	}
+
+	// Rank-1 update a += alpha * x * y^T. a is updated in column tiles: the tile of y is evaluated into a buffer
+	// on the stack that stays in L1 while all rows pass over it, alpha * x(i) is evaluated once per row and tile.
+	// x and y must not read a.
+	template<typename Ptr, typename T, typename Arg1, typename Arg2>
+	inline void Rank1Update(const details::MatrixView<Ptr> & a, T alpha, const Arg1 & x, const Arg2 & y)
+	{
+		using type = typename details::MatrixView<Ptr>::type;
+		const int rows = a.Rows(), cols = a.Cols();
+		const int tile = 256;
+		type yt[tile];
+		for (int jb = 0; jb < cols; jb += tile)
+		{
+			const int len = cols - jb < tile ? cols - jb : tile;
+			for (int j = 0; j < len; ++j) yt[j] = type(y.Evaluate(jb + j));
+			for (int i = 0; i < rows; ++i)
+			{
+				const Ptr r = a.RowPtr(i) + jb;
+				const type s = type(alpha * x.Evaluate(i));
+				for (int j = 0; j < len; ++j)
+					r[j] += s * yt[j];
+			}
+		}
+	}
+
+	// Covariance matrix (dim x dim) of samples in rows of batch (n x dim), normalized by n - 1.
+	// Done in a single pass: samples are shifted by the first one, sums and symmetric rank-k updates of shifted samples
+	// are accumulated in blocks per thread, mean is subtracted at the end. Accumulation type is element type of out.
+	template<typename InPtr, typename OutPtr>
+	inline void Covariance(const details::MatrixView<InPtr> & batch, const details::MatrixView<OutPtr> & out)
+	{
+		using acc = typename details::MatrixView<OutPtr>::type;
+		const int n = batch.Rows(), d = batch.Cols();
+		const int rowBlock = 64, tile = 64;
+		const int threads = details::ParallelThreads(n, 4 * rowBlock);
+
+		std::vector<acc> shift(d);
+		for (int p = 0; p < d && n > 0; ++p) shift[p] = acc(batch.Evaluate(0, p));
+		std::vector<std::vector<acc>> sq(threads, std::vector<acc>(size_t(d) * d, acc(0)));
+		std::vector<std::vector<acc>> sum(threads, std::vector<acc>(d, acc(0)));
+
+		details::ParallelFor(n, 4 * rowBlock, [&](int begin, int end, int t)
+		{
+			acc * S = sq[t].data();
+			acc * s = sum[t].data();
+			std::vector<acc> blk(size_t(rowBlock) * d);
+			for (int rb = begin; rb < end; rb += rowBlock)
+			{
+				const int rows = rb + rowBlock < end ? rowBlock : end - rb;
+				for (int r = 0; r < rows; ++r)
+				{
+					const InPtr x = batch.RowPtr(rb + r);
+					acc * b = blk.data() + size_t(r) * d;
+					for (int p = 0; p < d; ++p)
+					{
+						b[p] = acc(x[p]) - shift[p];
+						s[p] += b[p];
+					}
+				}
+				// upper triangle of S += blk^T * blk, tile by tile
+				for (int pb = 0; pb < d; pb += tile)
+				{
+					const int pe = pb + tile < d ? pb + tile : d;
+					for (int qb = pb; qb < d; qb += tile)
+					{
+						const int qe = qb + tile < d ? qb + tile : d;
+						for (int r = 0; r < rows; ++r)
+						{
+							const acc * b = blk.data() + size_t(r) * d;
+							for (int p = pb; p < pe; ++p)
+							{
+								const acc xp = b[p];
+								acc * Sp = S + size_t(p) * d;
+								for (int q = p > qb ? p : qb; q < qe; ++q)
+									Sp[q] += xp * b[q];
+							}
+						}
+					}
+				}
+			}
+		});
+
+		for (int t = 1; t < threads; ++t)
+		{
+			for (size_t k = 0; k < sq[0].size(); ++k) sq[0][k] += sq[t][k];
+			for (int p = 0; p < d; ++p) sum[0][p] += sum[t][p];
+		}
+		const acc * S = sq[0].data();
+		const acc * s = sum[0].data();
+		const acc norm = acc(n > 1 ? n - 1 : 1);
+		for (int p = 0; p < d; ++p)
+		{
+			for (int q = p; q < d; ++q)
+			{
+				const acc c = n > 0 ? (S[size_t(p) * d + q] - s[p] * s[q] / acc(n)) / norm : acc(0);
+				out.RowPtr(p)[q] = c;
+				out.RowPtr(q)[p] = c;
+			}
+		}
+	}
+
+	// Gram matrix (n x n) of dot products between rows of batch (n x dim).
+	// Computed by square tiles of upper triangle, tiles are distributed between threads, lower triangle is mirrored.
+	template<typename InPtr, typename OutPtr>
+	inline void Gram(const details::MatrixView<InPtr> & batch, const details::MatrixView<OutPtr> & out)
+	{
+		using acc = typename details::MatrixView<OutPtr>::type;
+		const int n = batch.Rows(), d = batch.Cols();
+		const int tile = 32;
+		const int tiles = (n + tile - 1) / tile;
+
+		details::ParallelFor(tiles * tiles, 1, [&](int begin, int end, int)
+		{
+			for (int k = begin; k < end; ++k)
+			{
+				const int ib = (k / tiles) * tile, jb = (k % tiles) * tile;
+				if (jb < ib) continue;
+				const int ie = ib + tile < n ? ib + tile : n;
+				const int je = jb + tile < n ? jb + tile : n;
+				for (int i = ib; i < ie; ++i)
+				{
+					for (int j = i > jb ? i : jb; j < je; ++j)
+					{
+						const acc g = details::DotKernel<acc>(batch.RowPtr(i), batch.RowPtr(j), d);
+						out.RowPtr(i)[j] = g;
+						out.RowPtr(j)[i] = g;
+					}
+				}
+			}
+		});
+	}
+
+	enum class Metric
+	{
+		SquaredL2,
+		L2,
+		Cosine // 1 - cos(a, b), distance to zero vector is 1
+	};
+
+	// Distances between every row of a (na x dim) and every row of b (nb x dim) written to out (na x nb).
+	// Uses |a|^2 + |b|^2 - 2 a.b: row norms are computed once, dot products are computed GEMM-style by DotTile
+	// and tiles are distributed between threads.
+	// Rounding can make expansion slightly negative, so results are clamped to valid range.
+	template<typename PtrA, typename PtrB, typename OutPtr>
+	inline void PairwiseDistances(const details::MatrixView<PtrA> & a, const details::MatrixView<PtrB> & b, Metric metric,
+		const details::MatrixView<OutPtr> & out)
+	{
+		using acc = typename details::MatrixView<OutPtr>::type;
+		const int na = a.Rows(), nb = b.Rows(), d = a.Cols();
+		std::vector<acc> norma(na), normb(nb);
+		for (int i = 0; i < na; ++i) norma[i] = details::DotKernel<acc>(a.RowPtr(i), a.RowPtr(i), d);
+		for (int j = 0; j < nb; ++j) normb[j] = details::DotKernel<acc>(b.RowPtr(j), b.RowPtr(j), d);
+
+		auto finish = [&](int i, int j, acc dot)
+		{
+			acc r;
+			if (metric == Metric::Cosine)
+			{
+				const acc nn = norma[i] * normb[j];
+				r = nn > acc(0) ? acc(1) - dot / acc(std::sqrt(nn)) : acc(1);
+				r = r < acc(0) ? acc(0) : (r > acc(2) ? acc(2) : r);
+			}
+			else
+			{
+				r = norma[i] + normb[j] - acc(2) * dot;
+				r = r < acc(0) ? acc(0) : r;
+				if (metric == Metric::L2) r = acc(std::sqrt(r));
+			}
+			out.RowPtr(i)[j] = r;
+		};
+
+		const int tileA = 64, tileB = 64;
+		const int tilesA = (na + tileA - 1) / tileA, tilesB = (nb + tileB - 1) / tileB;
+		details::ParallelFor(tilesA * tilesB, 1, [&](int begin, int end, int)
+		{
+			for (int k = begin; k < end; ++k)
+			{
+				const int ib = (k / tilesB) * tileA, jb = (k % tilesB) * tileB;
+				const int ie = ib + tileA < na ? ib + tileA : na;
+				const int je = jb + tileB < nb ? jb + tileB : nb;
+				details::DotTile<acc>(a, ib, ie, b, jb, je, finish);
+			}
+		});
+	}
+
+	enum class Reduction
+	{
+		Sum,
+		Mean,
+		SquaredNorm,
+		Norm,
+		Min,
+		Max
+	};
+
+	namespace details
+	{
+		// Reduction of one contiguous row with 4 independent accumulators
+		template<typename Acc, typename T>
+		inline Acc ReduceKernel(const T * x, int n, Reduction op)
+		{
+			if (op == Reduction::SquaredNorm || op == Reduction::Norm)
+			{
+				const Acc s = DotKernel<Acc>(x, x, n);
+				return op == Reduction::Norm ? Acc(std::sqrt(s)) : s;
+			}
+			if (n == 0)
+				return Acc(0);
+			if (op == Reduction::Min || op == Reduction::Max)
+			{
+				const bool min = op == Reduction::Min;
+				Acc r0 = Acc(x[0]), r1 = r0, r2 = r0, r3 = r0;
+				int i = 0;
+				for (; i + 4 <= n; i += 4)
+				{
+					const Acc a = Acc(x[i]), b = Acc(x[i + 1]), c = Acc(x[i + 2]), d = Acc(x[i + 3]);
+					r0 = (a < r0) == min ? a : r0;
+					r1 = (b < r1) == min ? b : r1;
+					r2 = (c < r2) == min ? c : r2;
+					r3 = (d < r3) == min ? d : r3;
+				}
+				for (; i < n; ++i)
+					r0 = (Acc(x[i]) < r0) == min ? Acc(x[i]) : r0;
+				r0 = (r1 < r0) == min ? r1 : r0;
+				r2 = (r3 < r2) == min ? r3 : r2;
+				return (r2 < r0) == min ? r2 : r0;
+			}
+			Acc s0 = Acc(0), s1 = Acc(0), s2 = Acc(0), s3 = Acc(0);
+			int i = 0;
+			for (; i + 4 <= n; i += 4)
+			{
+				s0 += Acc(x[i]);
+				s1 += Acc(x[i + 1]);
+				s2 += Acc(x[i + 2]);
+				s3 += Acc(x[i + 3]);
+			}
+			for (; i < n; ++i)
+				s0 += Acc(x[i]);
+			const Acc s = (s0 + s1) + (s2 + s3);
+			return op == Reduction::Mean ? Acc(s / Acc(n)) : s;
+		}
+
+		// Folds row x into column accumulators r. Loop runs along the row, so it is contiguous and vectorizes.
+		template<typename Acc, typename T>
+		inline void AccumulateRow(Acc * r, const T * x, int n, Reduction op, bool first)
+		{
+			switch (op)
+			{
+			case Reduction::Min:
+				for (int j = 0; j < n; ++j) r[j] = first || Acc(x[j]) < r[j] ? Acc(x[j]) : r[j];
+				break;
+			case Reduction::Max:
+				for (int j = 0; j < n; ++j) r[j] = first || r[j] < Acc(x[j]) ? Acc(x[j]) : r[j];
+				break;
+			case Reduction::SquaredNorm:
+			case Reduction::Norm:
+				for (int j = 0; j < n; ++j) r[j] = (first ? Acc(0) : r[j]) + Acc(x[j]) * Acc(x[j]);
+				break;
+			default:
+				for (int j = 0; j < n; ++j) r[j] = (first ? Acc(0) : r[j]) + Acc(x[j]);
+				break;
+			}
+		}
+	}
+
+	// Reduces every row of m to one value written to out (m.Rows() coordinates), i.e. row norms.
+	// Rows are contiguous, so each is reduced by a multi-accumulator kernel, blocks of rows are distributed between threads.
+	template<typename Ptr, typename Storage>
+	inline void RowReduce(const details::MatrixView<Ptr> & m, Reduction op, const details::AssignableVectorView<Storage> & out)
+	{
+		using acc = typename Storage::ElementType;
+		const int cols = m.Cols();
+		details::ParallelFor(m.Rows(), 1024, [&](int begin, int end, int)
+		{
+			for (int i = begin; i < end; ++i)
+				out.GetStorage()[i] = details::ReduceKernel<acc>(m.RowPtr(i), cols, op);
+		});
+	}
+
+	// Reduces every column of m to one value written to out (m.Cols() coordinates), i.e. column sums.
+	// Columns are not walked with stride: every thread accumulates rows of its blocks into its own vector of column
+	// partials with contiguous row-wise loops, then partials are combined.
+	template<typename Ptr, typename Storage>
+	inline void ColReduce(const details::MatrixView<Ptr> & m, Reduction op, const details::AssignableVectorView<Storage> & out)
+	{
+		using acc = typename Storage::ElementType;
+		const int rows = m.Rows(), cols = m.Cols(), block = 256;
+		const int threads = details::ParallelThreads(rows, block);
+		std::vector<acc> partial(size_t(threads) * cols);
+		std::vector<char> used(threads, 0);
+		details::ParallelFor(rows, block, [&](int begin, int end, int t)
+		{
+			acc * r = partial.data() + size_t(t) * cols;
+			for (int i = begin; i < end; ++i)
+			{
+				details::AccumulateRow(r, m.RowPtr(i), cols, op, !used[t]);
+				used[t] = 1;
+			}
+		});
+
+		acc * r = nullptr;
+		for (int t = 0; t < threads; ++t)
+		{
+			if (!used[t]) continue;
+			acc * p = partial.data() + size_t(t) * cols;
+			if (r)
+				details::AccumulateRow(r, p, cols, op == Reduction::Min || op == Reduction::Max ? op : Reduction::Sum, false);
+			else
+				r = p;
+		}
+		for (int j = 0; j < cols; ++j)
+		{
+			acc v = r ? r[j] : acc(0);
+			if (op == Reduction::Mean && rows > 0) v = acc(v / acc(rows));
+			if (op == Reduction::Norm) v = acc(std::sqrt(v));
+			out.GetStorage()[j] = v;
+		}
+	}
+
+	namespace details
+	{
+		// Transpose of 4x4 blocks of 4 byte elements in SSE registers. All rows are loaded before anything is stored,
+		// so source and destination may be the same block.
+		template<typename T>
+		struct TransposeBlock4
+		{
+			static const bool supported =
+#ifdef VEVI_SSE2
+				std::is_arithmetic<T>::value && sizeof(T) == 4;
+#else
+				false;
+#endif
+
+			// dst = src^T
+			static void run(const T * src, int lds, T * dst, int ldd)
+			{
+#ifdef VEVI_SSE2
+				__m128 r0 = Load(src), r1 = Load(src + lds), r2 = Load(src + 2 * lds), r3 = Load(src + 3 * lds);
+				_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+				Store(dst, r0); Store(dst + ldd, r1); Store(dst + 2 * ldd, r2); Store(dst + 3 * ldd, r3);
+#else
+				(void)src; (void)lds; (void)dst; (void)ldd;
+#endif
+			}
+
+			// a = b^T and b = a^T at once
+			static void swap(T * a, T * b, int ld)
+			{
+#ifdef VEVI_SSE2
+				__m128 a0 = Load(a), a1 = Load(a + ld), a2 = Load(a + 2 * ld), a3 = Load(a + 3 * ld);
+				__m128 b0 = Load(b), b1 = Load(b + ld), b2 = Load(b + 2 * ld), b3 = Load(b + 3 * ld);
+				_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+				_MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+				Store(a, b0); Store(a + ld, b1); Store(a + 2 * ld, b2); Store(a + 3 * ld, b3);
+				Store(b, a0); Store(b + ld, a1); Store(b + 2 * ld, a2); Store(b + 3 * ld, a3);
+#else
+				(void)a; (void)b; (void)ld;
+#endif
+			}
+		private:
+#ifdef VEVI_SSE2
+			static __m128 Load(const T * p) { return _mm_loadu_ps(reinterpret_cast<const float*>(p)); }
+			static void Store(T * p, __m128 r) { _mm_storeu_ps(reinterpret_cast<float*>(p), r); }
+#endif
+		};
+
+		// Writes transpose of in[ib, ie) x [jb, je) to out. Full 4x4 blocks go through SSE when element types match.
+		template<typename InPtr, typename OutPtr>
+		inline void TransposeTile(const MatrixView<InPtr> & in, const MatrixView<OutPtr> & out, int ib, int ie, int jb, int je)
+		{
+			using T = typename MatrixView<OutPtr>::type;
+			const bool simd = TransposeBlock4<T>::supported && std::is_same<typename MatrixView<InPtr>::type, T>::value;
+			const int i4 = simd ? ib + (ie - ib) / 4 * 4 : ib, j4 = simd ? jb + (je - jb) / 4 * 4 : jb;
+			for (int i = ib; i < i4; i += 4)
+				for (int j = jb; j < j4; j += 4)
+					TransposeBlock4<T>::run(reinterpret_cast<const T*>(in.RowPtr(i) + j), in.Stride(), out.RowPtr(j) + i, out.Stride());
+			for (int i = ib; i < ie; ++i)
+			{
+				const InPtr r = in.RowPtr(i);
+				for (int j = i < i4 ? j4 : jb; j < je; ++j)
+					out.RowPtr(j)[i] = T(r[j]);
+			}
+		}
+
+		// Swaps tile [ib, ie) x [jb, je) of square matrix with its mirror tile transposing both. Diagonal tiles are
+		// transposed in place.
+		template<typename T>
+		inline void TransposeTileInPlace(T * p, int ld, int ib, int ie, int jb, int je)
+		{
+			const bool diag = ib == jb;
+			const bool simd = TransposeBlock4<T>::supported;
+			const int i4 = simd ? ib + (ie - ib) / 4 * 4 : ib, j4 = simd ? jb + (je - jb) / 4 * 4 : jb;
+			for (int i = ib; i < i4; i += 4)
+				for (int j = diag ? i : jb; j < j4; j += 4)
+				{
+					if (i == j)
+						TransposeBlock4<T>::run(p + i * ld + j, ld, p + i * ld + j, ld);
+					else
+						TransposeBlock4<T>::swap(p + i * ld + j, p + j * ld + i, ld);
+				}
+			for (int i = ib; i < ie; ++i)
+				for (int j = diag ? i + 1 : jb; j < je; ++j)
+				{
+					if (i < i4 && j < j4) continue;
+					const T t = p[i * ld + j];
+					p[i * ld + j] = p[j * ld + i];
+					p[j * ld + i] = t;
+				}
+		}
+	}
+
+	// Transposes in (rows x cols) into out (cols x rows). Work is split in square tiles that fit in L1 for both
+	// reading and writing, tiles are distributed between threads. Matrices must not overlap.
+	template<typename InPtr, typename OutPtr>
+	inline void Transpose(const details::MatrixView<InPtr> & in, const details::MatrixView<OutPtr> & out)
+	{
+		const int tile = 32;
+		const int rows = in.Rows(), cols = in.Cols();
+		const int tilesI = (rows + tile - 1) / tile, tilesJ = (cols + tile - 1) / tile;
+		details::ParallelFor(tilesI * tilesJ, 16, [&](int begin, int end, int)
+		{
+			for (int k = begin; k < end; ++k)
+			{
+				const int ib = (k / tilesJ) * tile, jb = (k % tilesJ) * tile;
+				details::TransposeTile(in, out, ib, ib + tile < rows ? ib + tile : rows, jb, jb + tile < cols ? jb + tile : cols);
+			}
+		});
+	}
+
+	// Transposes square matrix in place. Pairs of mirrored tiles are swapped, pairs are distributed between threads.
+	template<typename T>
+	inline void Transpose(const details::MatrixView<T*> & m)
+	{
+		const int tile = 32;
+		const int n = m.Rows();
+		const int tiles = (n + tile - 1) / tile;
+		std::vector<std::pair<int, int>> pairs;
+		for (int bi = 0; bi < tiles; ++bi)
+			for (int bj = bi; bj < tiles; ++bj)
+				pairs.push_back(std::make_pair(bi * tile, bj * tile));
+		details::ParallelFor(int(pairs.size()), 16, [&](int begin, int end, int)
+		{
+			for (int k = begin; k < end; ++k)
+			{
+				const int ib = pairs[k].first, jb = pairs[k].second;
+				details::TransposeTileInPlace(m.Data(), m.Stride(), ib, ib + tile < n ? ib + tile : n, jb, jb + tile < n ? jb + tile : n);
+			}
+		});
+	}
+
+	// Batched operations on multi-component vectors, i.e. AVec(lens, n) = BatchNorm(VecN<3>(points, n))
+	template<typename Arg1, typename Arg2>
+	inline details::BinOp<details::PointDot, Arg1, Arg2> BatchDot(const Arg1 & v1, const Arg2 & v2)
+	{
+		return details::BinOp<details::PointDot, Arg1, Arg2>(v1, v2);
+	}
+
+	template<typename Arg1, typename Arg2>
+	inline details::BinOp<details::PointCross, Arg1, Arg2> BatchCross(const Arg1 & v1, const Arg2 & v2)
+	{
+		return details::BinOp<details::PointCross, Arg1, Arg2>(v1, v2);
+	}
+
+	template<typename Arg1>
+	inline details::UnaOp<details::PointNorm, Arg1> BatchNorm(const Arg1 & v)
+	{
+		return details::UnaOp<details::PointNorm, Arg1>(v);
+	}
+
+	template<typename Arg1>
+	inline details::UnaOp<details::PointNormalize, Arg1> BatchNormalize(const Arg1 & v)
+	{
+		return details::UnaOp<details::PointNormalize, Arg1>(v);
+	}
+
 	bool tests();
+	// Prints timings of slower paths relative to expression templates, see main
+	void benchmarks();
 }
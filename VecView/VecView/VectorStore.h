@@ -0,0 +1,312 @@
+//
+// Store of fixed dimention vectors for read-mostly concurrent use: many readers scan and look up vectors
+// while writers update them.
+// Slots are kept in chunks of contiguous rows, so a vector is a contiguous row and a chunk is an ordinary matrix view
+// that scans (Dot, PairwiseDistances, ...) run over at full speed.
+//
+// Updates are copy-on-write (read-copy-update): a writer copies the chunks it changes, writes new values into the copies
+// and publishes a new table of chunks with one atomic store. Readers never lock or wait: Read() registers the reader
+// in an epoch slot (slots are added in groups of 64 when all are taken) and returns a snapshot of the current table, which stays unchanged while the snapshot lives.
+// Replaced chunks are freed once no reader registered before the publication remains (epoch based reclamation).
+// Writers are serialized between themselves by a mutex.
+//
+// AppendOnlyStore is a growing collection for continuous ingestion. Vectors are appended to segments that double in size
+// and are never moved or freed while the store lives, so pointers and Vec views to them stay valid. One writer appends
+// without waiting for anybody; readers see vectors up to Size() and scan them segment by segment, each segment being
+// a contiguous matrix.
+//
+// Use example:
+//
+// VectorStore<float> store(128, 1000000);
+// store.Update(42, embedding);                       // publishes the whole vector at once
+// {
+//     auto snap = store.Read();                      // consistent view, lock free
+//     float d = Dot(snap.Vec(42), Vec(query));
+//     for (int c = 0; c < snap.Chunks(); ++c)
+//         PairwiseDistances(snap.Chunk(c), Mat(query, 1, 128), Metric::L2, AMat(dist + snap.ChunkBegin(c), snap.Chunk(c).Rows(), 1, 1));
+// }
+//
+// AppendOnlyStore<float> log(128);
+// log.Append(embedding);                             // by the only writer thread
+// const int n = log.Size();                          // by readers
+// for (int k = 0; k < log.Segments(n); ++k)
+//     RowReduce(log.Segment(k, n), Reduction::Norm, AVec(norms + log.SegmentBegin(k), log.Segment(k, n).Rows()));
+//
+
+#pragma once
+
+#include "VecView.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+namespace vevi
+{
+	template<typename T>
+	class VectorStore
+	{
+		// Published state, never changed after publication
+		struct Table
+		{
+			std::vector<const T*> chunks;
+		};
+
+		struct Retired
+		{
+			std::uint64_t epoch;
+			const Table * table;
+			std::vector<const T*> chunks;
+		};
+
+		// Epochs readers registered at, 0 for free slots. Groups are only added, never removed while the store lives.
+		struct Readers
+		{
+			static const int Slots = 64;
+			std::atomic<std::uint64_t> slots[Slots];
+			std::atomic<Readers*> next;
+
+			Readers() : next(nullptr)
+			{
+				for (int r = 0; r < Slots; ++r) slots[r].store(0);
+			}
+		};
+
+		const int dim, size, chunkRows;
+		std::atomic<const Table*> current;
+		std::atomic<std::uint64_t> epoch;
+		Readers readers;
+		std::mutex writer;
+		std::vector<Retired> retired;
+
+		int ChunkCount() const { return (size + chunkRows - 1) / chunkRows; }
+		int RowsIn(int c) const { return size - c * chunkRows < chunkRows ? size - c * chunkRows : chunkRows; }
+
+		std::atomic<std::uint64_t> * Acquire()
+		{
+			const std::uint64_t e = epoch.load();
+			for (Readers * group = &readers;;)
+			{
+				for (int r = 0; r < Readers::Slots; ++r)
+				{
+					std::uint64_t expected = 0;
+					if (group->slots[r].compare_exchange_strong(expected, e))
+						return &group->slots[r];
+				}
+				// All slots are taken, append a group unless another reader did it first
+				Readers * next = group->next.load();
+				if (!next)
+				{
+					Readers * added = new Readers;
+					if (group->next.compare_exchange_strong(next, added))
+						next = added;
+					else
+						delete added;
+				}
+				group = next;
+			}
+		}
+
+		// Frees retired chunks that no registered reader can see. Called by writers under the mutex.
+		void Reclaim()
+		{
+			std::uint64_t oldest = epoch.load();
+			for (const Readers * group = &readers; group; group = group->next.load())
+				for (int r = 0; r < Readers::Slots; ++r)
+				{
+					const std::uint64_t e = group->slots[r].load();
+					if (e != 0 && e < oldest) oldest = e;
+				}
+			size_t kept = 0;
+			for (size_t i = 0; i < retired.size(); ++i)
+			{
+				if (retired[i].epoch < oldest)
+				{
+					for (const T * chunk : retired[i].chunks) delete[] chunk;
+					delete retired[i].table;
+				}
+				else if (kept++ != i)
+					retired[kept - 1] = std::move(retired[i]);
+			}
+			retired.resize(kept);
+		}
+
+	public:
+		// Consistent read only view of the store. Holds its epoch slot until destroyed, so keep it short lived.
+		class Snapshot
+		{
+			VectorStore<T> * store;
+			const Table * table;
+			std::atomic<std::uint64_t> * slot;
+		public:
+			Snapshot(VectorStore<T> * store, const Table * table, std::atomic<std::uint64_t> * slot) : store(store), table(table), slot(slot) {}
+			Snapshot(Snapshot && s) : store(s.store), table(s.table), slot(s.slot) { s.store = nullptr; }
+			Snapshot(const Snapshot &) = delete;
+			Snapshot & operator=(const Snapshot &) = delete;
+			~Snapshot()
+			{
+				if (store) slot->store(0);
+			}
+
+			int Dim() const { return store->dim; }
+			int Size() const { return store->size; }
+			const T * Row(int i) const { return table->chunks[i / store->chunkRows] + size_t(i % store->chunkRows) * store->dim; }
+			details::VectorView<details::storages::ArrayPtr<const T*>> Vec(int i) const { return{ { Row(i) }, store->dim }; }
+
+			// Chunks are contiguous blocks of rows, chunk c keeps rows [ChunkBegin(c), ChunkBegin(c) + Chunk(c).Rows())
+			int Chunks() const { return store->ChunkCount(); }
+			int ChunkBegin(int c) const { return c * store->chunkRows; }
+			details::MatrixView<const T*> Chunk(int c) const { return{ table->chunks[c], store->RowsIn(c), store->dim, store->dim }; }
+		};
+
+		// size vectors of dim coordinates, all zero
+		VectorStore(int dim, int size, int chunkRows = 1024) : dim(dim), size(size), chunkRows(chunkRows), epoch(1)
+		{
+			Table * table = new Table;
+			for (int c = 0; c < ChunkCount(); ++c)
+			{
+				T * chunk = new T[size_t(RowsIn(c)) * dim];
+				for (size_t k = 0; k < size_t(RowsIn(c)) * dim; ++k) chunk[k] = T(0);
+				table->chunks.push_back(chunk);
+			}
+			current.store(table);
+		}
+
+		~VectorStore()
+		{
+			const Table * table = current.load();
+			for (const T * chunk : table->chunks) delete[] chunk;
+			delete table;
+			for (size_t i = 0; i < retired.size(); ++i)
+			{
+				for (const T * chunk : retired[i].chunks) delete[] chunk;
+				delete retired[i].table;
+			}
+			for (Readers * group = readers.next.load(); group;)
+			{
+				Readers * next = group->next.load();
+				delete group;
+				group = next;
+			}
+		}
+
+		VectorStore(const VectorStore<T> &) = delete;
+		VectorStore<T> & operator=(const VectorStore<T> &) = delete;
+
+		int Dim() const { return dim; }
+		int Size() const { return size; }
+
+		// Lock free, readers never wait for writers
+		Snapshot Read()
+		{
+			std::atomic<std::uint64_t> * slot = Acquire();
+			return Snapshot(this, current.load(), slot);
+		}
+
+		// Replaces vectors in slots ids[0..n) with rows of values (n x dim). All of them become visible at once.
+		void Update(const int * ids, const T * values, int n)
+		{
+			std::lock_guard<std::mutex> lock(writer);
+			const Table * old = current.load();
+			Table * table = new Table(*old);
+			Retired r;
+			for (int k = 0; k < n; ++k)
+			{
+				const int c = ids[k] / chunkRows;
+				if (table->chunks[c] == old->chunks[c])
+				{
+					T * copy = new T[size_t(RowsIn(c)) * dim];
+					std::copy(old->chunks[c], old->chunks[c] + size_t(RowsIn(c)) * dim, copy);
+					table->chunks[c] = copy;
+					r.chunks.push_back(old->chunks[c]);
+				}
+				T * row = const_cast<T*>(table->chunks[c]) + size_t(ids[k] % chunkRows) * dim;
+				std::copy(values + size_t(k) * dim, values + size_t(k + 1) * dim, row);
+			}
+			current.store(table);
+			// Readers registered before this increment may still use old chunks
+			r.epoch = epoch.fetch_add(1);
+			r.table = old;
+			retired.push_back(std::move(r));
+			Reclaim();
+		}
+
+		void Update(int id, const T * values)
+		{
+			Update(&id, values, 1);
+		}
+	};
+
+	template<typename T>
+	class AppendOnlyStore
+	{
+		// Segment k keeps rows [first * (2^k - 1), first * (2^(k + 1) - 1)), so 31 segments cover any int size
+		static const int MaxSegments = 31;
+
+		const int dim, first;
+		std::atomic<T*> segments[MaxSegments];
+		std::atomic<int> size;
+
+		int SegmentOf(int i) const
+		{
+			int k = 0;
+			for (unsigned q = unsigned(i / first) + 1; q > 1; q >>= 1) ++k;
+			return k;
+		}
+
+	public:
+		// firstSegmentRows is the size of the first segment, each next one is twice bigger
+		AppendOnlyStore(int dim, int firstSegmentRows = 1024) : dim(dim), first(firstSegmentRows), size(0)
+		{
+			for (int k = 0; k < MaxSegments; ++k) segments[k].store(nullptr);
+		}
+
+		~AppendOnlyStore()
+		{
+			for (int k = 0; k < MaxSegments; ++k) delete[] segments[k].load();
+		}
+
+		AppendOnlyStore(const AppendOnlyStore<T> &) = delete;
+		AppendOnlyStore<T> & operator=(const AppendOnlyStore<T> &) = delete;
+
+		int Dim() const { return dim; }
+		// Number of vectors visible to readers
+		int Size() const { return size.load(std::memory_order_acquire); }
+
+		// Appends a vector of dim coordinates and returns its index. Only one thread may append.
+		int Append(const T * values)
+		{
+			const int i = size.load(std::memory_order_relaxed);
+			const int k = SegmentOf(i);
+			T * segment = segments[k].load(std::memory_order_relaxed);
+			if (!segment)
+			{
+				segment = new T[size_t(SegmentRows(k)) * dim];
+				segments[k].store(segment, std::memory_order_release);
+			}
+			std::copy(values, values + dim, segment + size_t(i - SegmentBegin(k)) * dim);
+			// Vector is complete before it becomes visible
+			size.store(i + 1, std::memory_order_release);
+			return i;
+		}
+
+		// Row i < Size(), the pointer stays valid while the store lives
+		const T * Row(int i) const
+		{
+			const int k = SegmentOf(i);
+			return segments[k].load(std::memory_order_acquire) + size_t(i - SegmentBegin(k)) * dim;
+		}
+		details::VectorView<details::storages::ArrayPtr<const T*>> Vec(int i) const { return{ { Row(i) }, dim }; }
+
+		// Segments holding the first n vectors (n <= Size()), segment k keeps rows [SegmentBegin(k), SegmentBegin(k) + Segment(k, n).Rows())
+		int Segments(int n) const { return n > 0 ? SegmentOf(n - 1) + 1 : 0; }
+		int SegmentBegin(int k) const { return first * ((1 << k) - 1); }
+		int SegmentRows(int k) const { return first << k; }
+		details::MatrixView<const T*> Segment(int k, int n) const
+		{
+			const int rows = n - SegmentBegin(k) < SegmentRows(k) ? n - SegmentBegin(k) : SegmentRows(k);
+			return{ segments[k].load(std::memory_order_acquire), rows, dim, dim };
+		}
+	};
+}
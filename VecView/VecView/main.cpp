@@ -1,8 +1,12 @@
 #include "VecView.h"
+#include <cstring>
 
-int main()
+// "VecView bench" also runs benchmarks after tests
+int main(int argc, char * argv[])
 {
 	vevi::tests();
+	if (argc > 1 && std::strcmp(argv[1], "bench") == 0)
+		vevi::benchmarks();
 
 	return 0;
 }
\ No newline at end of file